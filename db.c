@@ -6,17 +6,34 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <stdbool.h>
+#include <math.h>
 #include "db.h"
+#include "smgr.h"
 
 Conf* cf = NULL;
 Database* db = NULL;
 
+// slots of the ring of a large sequential scan unless it is configured,
+// 256kB of 8kB pages as in PostgreSQL
+#define DEFAULT_RING_SLOTS 32
+
+// read-ahead is off unless it is configured
+#define DEFAULT_PREFETCH_DEPTH 0
+
+// selections scan with one thread unless it is configured
+#define DEFAULT_PARALLEL_WORKERS 1
+
 Conf* init_conf(const UINT page_size, const UINT buf_slots, const UINT file_limit, const char* buf_policy){
     cf = malloc(sizeof(Conf));
     cf->page_size = page_size;
     cf->buf_slots = buf_slots;
     cf->file_limit = file_limit;
-    strcpy(cf->buf_policy,buf_policy);
+    snprintf(cf->buf_policy,sizeof(cf->buf_policy),"%s",buf_policy);
+    cf->smgr = SMGR_PREAD;
+    cf->ring_slots = DEFAULT_RING_SLOTS;
+    cf->prefetch_depth = DEFAULT_PREFETCH_DEPTH;
+    cf->parallel_workers = DEFAULT_PARALLEL_WORKERS;
     return cf;
 }
 
@@ -33,192 +50,805 @@ Database* get_db(){
 }
 
 void free_db(){
-    if (db != NULL) free(db);
+    if (db != NULL){
+        for (UINT i = 0; i < db->ntables; i++){
+            free(db->tables[i].stats);
+            free(db->tables[i].pids);
+            free(db->tables[i].tablespace);
+        }
+        free(db->indexes);
+        free(db);
+    }
 }
 
+Index* add_index(UINT table_oid, UINT idx){
+    // oid after the largest oid in use
+    UINT oid = 0;
+    for (UINT i = 0; i < db->ntables; i++){
+        if (db->tables[i].oid > oid) oid = db->tables[i].oid;
+    }
+    for (UINT i = 0; i < db->nindexes; i++){
+        if (db->indexes[i].oid > oid) oid = db->indexes[i].oid;
+    }
 
-// build database
-Database* init_db(char* input_data_path, char* data_path){
-    
-    
-    // check if db folder exists
+    db->indexes = realloc(db->indexes, sizeof(Index)*(db->nindexes+1));
+    Index* index = &db->indexes[db->nindexes];
+    db->nindexes++;
+
+    memset(index, 0, sizeof(Index));
+    index->oid = oid + 1;
+    index->table_oid = table_oid;
+    index->idx = idx;
+    return index;
+}
+
+void make_path(char* path, size_t size, const char* folder, const char* name){
+    if ((size_t)snprintf(path,size,"%s/%s",folder,name) >= size){
+        printf("Path of %s in %s is too long.\n",name,folder);
+        exit(-1);
+    }
+}
+
+void file_path(UINT oid, char* path, size_t size){
+    // an index is stored with the table it is built on
+    UINT table_oid = oid;
+    for (UINT i = 0; i < db->nindexes; i++){
+        if (db->indexes[i].oid == oid) table_oid = db->indexes[i].table_oid;
+    }
+
+    const char* folder = db->path;
+    for (UINT i = 0; i < db->ntables; i++){
+        if (db->tables[i].oid == table_oid && db->tables[i].tablespace != NULL){
+            folder = db->tables[i].tablespace;
+        }
+    }
+
+    // the longest length for oid in char is 11 bytes, 2^32 = 4294967296
+    char name[11];
+    snprintf(name,sizeof(name),"%u",oid);
+    make_path(path,size,folder,name);
+}
+
+// create a folder for the database or a tablespace if it does not exist
+static void make_folder(const char* what, const char* folder){
     struct stat st = {0};
-    if(stat(data_path, &st) == -1){
-        printf("Database folder does not exist. Create the folder %s.\n",data_path);
-        mkdir(data_path, 0777);
+    if(stat(folder, &st) == -1){
+        printf("%s folder does not exist. Create the folder %s.\n",what,folder);
+        mkdir(folder, 0777);
     }
+}
 
-    
-    db = NULL;
+// set the folder of the database, which must fit in Database.path
+static void set_db_path(const char* data_path){
+    if (strlen(data_path) >= sizeof(db->path)){
+        printf("Database path %s is too long.\n",data_path);
+        exit(-1);
+    }
+    strcpy(db->path,data_path);
+}
 
-    
-    // open the input data file
-    FILE* input_fp = fopen(input_data_path,"r");
-    printf("Input data path:%s\n",input_data_path);
-    if (input_fp == NULL){
-        perror("Fail to open the input data file.\n");
+Index* find_index(UINT table_oid, UINT idx){
+    for (UINT i = 0; i < db->nindexes; i++){
+        if (db->indexes[i].table_oid == table_oid && db->indexes[i].idx == idx){
+            return &db->indexes[i];
+        }
+    }
+    return NULL;
+}
+
+
+// allocate a _Table with room for ntuples tuples in one allocation,
+// the tuple pointers are set, the attributes are left for the caller
+_Table* new_table(UINT nattrs, UINT ntuples){
+    _Table* t = malloc(sizeof(_Table) + ntuples*sizeof(Tuple) + (size_t)ntuples*nattrs*sizeof(INT));
+    t->nattrs = nattrs;
+    t->ntuples = ntuples;
+    INT* data = table_data(t);
+    for (UINT i = 0; i < ntuples; i++){
+        t->tuples[i] = data + (size_t)i*nattrs;
+    }
+    return t;
+}
+
+// size of the buffer used to read input data
+#define LOAD_BUFFER_SIZE (1 << 20)
+
+// magic number at the beginning of a binary input data file
+#define BINARY_MAGIC "DBB1"
+
+// catalog file in the database folder, it starts with its magic number,
+// the page size and the number of tables, then each table is stored as
+// its oid, name, nattrs, ntuples, npages, the page id of each of its
+// npages pages in file order, sorted_attrs, whether it has
+// statistics and one Attr_stats per attribute if it has, the length of
+// its tablespace (0 for none) and the tablespace, then the number of
+// indexes and each Index
+#define CATALOG_FILE "catalog"
+#define CATALOG_MAGIC "DBC3"
+
+// buffered reader over the input data file, the file is read in large
+// blocks instead of one line at a time
+typedef struct Reader{
+    FILE* fp;
+    char* buf;
+    size_t len;
+    size_t pos;
+}Reader;
+
+// number of registers of the hyperloglog sketch of each attribute
+#define HLL_BITS 10
+#define HLL_NREGISTERS (1 << HLL_BITS)
+
+// number of tuples kept in the sample histograms are built from, tables
+// with at most this many tuples are kept whole and get exact statistics
+#define STATS_SAMPLE_SIZE 8192
+
+// statistics being gathered over the tuples of one table
+typedef struct Stats_builder{
+    INT8* hll;             // hyperloglog registers, HLL_NREGISTERS per attribute
+    INT* sample;            // reservoir sample of tuples, one after another
+    UINT64 nsampled;        // tuples in the sample
+    UINT64 nseen;           // tuples offered to the sample
+    UINT64 rand;            // state of the random generator of reservoir sampling
+}Stats_builder;
+
+// assemble one page of a table in memory and write it with a single write
+typedef struct Page_builder{
+    Table* table;           // the table being loaded
+    FILE* fp;
+    INT8* page;
+    UINT nattrs;
+    UINT ntuples_per_page;
+    UINT processed_ntuples;
+    UINT64 page_id;
+    UINT64 pids_capacity;   // page ids table->pids has room for
+    INT* prev_tuple;        // last tuple we added, to check which attributes are sorted
+    bool has_prev;
+    Stats_builder stats;
+}Page_builder;
+
+// look at the next character, -1 at the end of file
+static inline int peek_char(Reader* r){
+    if (r->pos == r->len){
+        r->len = fread(r->buf, 1, LOAD_BUFFER_SIZE, r->fp);
+        r->pos = 0;
+        if (r->len == 0) return -1;
+    }
+    return (unsigned char)r->buf[r->pos];
+}
+
+static inline void skip_char(Reader* r){
+    r->pos++;
+}
+
+// skip separators between two values in one line, values can be
+// separated by space, tab or comma (csv)
+static inline void skip_separators(Reader* r){
+    int c = peek_char(r);
+    while (c == ' ' || c == '\t' || c == ',' || c == '\r'){
+        skip_char(r);
+        c = peek_char(r);
+    }
+}
+
+// skip the rest of current line, including '\n'
+static void skip_line(Reader* r){
+    int c = peek_char(r);
+    while (c != -1 && c != '\n'){
+        skip_char(r);
+        c = peek_char(r);
+    }
+    if (c == '\n') skip_char(r);
+}
+
+// read a word separated by blanks, truncate it if it is longer than size - 1
+static void read_word(Reader* r, char* word, size_t size){
+    skip_separators(r);
+    size_t n = 0;
+    int c = peek_char(r);
+    while (c != -1 && !isspace(c) && c != ','){
+        if (n + 1 < size) word[n++] = (char)c;
+        skip_char(r);
+        c = peek_char(r);
+    }
+    word[n] = '\0';
+}
+
+// parse an integer without sscanf, return false if there is no integer
+// left in current line
+static bool read_int(Reader* r, INT* value){
+    skip_separators(r);
+    int c = peek_char(r);
+    bool negative = false;
+    if (c == '-' || c == '+'){
+        negative = (c == '-');
+        skip_char(r);
+        c = peek_char(r);
+    }
+    if (c == -1 || !isdigit(c)) return false;
+
+    int64_t v = 0;
+    while (c != -1 && isdigit(c)){
+        v = v * 10 + (c - '0');
+        skip_char(r);
+        c = peek_char(r);
+    }
+    *value = (INT)(negative ? -v : v);
+    return true;
+}
+
+// bits of sorted_attrs before any tuple is seen, every attribute is sorted
+static inline UINT64 all_sorted(UINT nattrs){
+    return nattrs >= 64 ? ~(UINT64)0 : (((UINT64)1 << nattrs) - 1);
+}
+
+// mix the bits of a value, splitmix64 finalizer
+static inline UINT64 mix64(UINT64 x){
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static void start_stats(Stats_builder* s, UINT nattrs){
+    s->hll = calloc((size_t)nattrs*HLL_NREGISTERS, 1);
+    s->sample = malloc(sizeof(INT)*nattrs*STATS_SAMPLE_SIZE);
+    s->nsampled = 0;
+    s->nseen = 0;
+    s->rand = 0x9E3779B97F4A7C15ULL;
+}
+
+// add a tuple to the sketches, min and max of the table and the sample
+static inline void collect_stats(Page_builder* b, const INT* tuple){
+    Stats_builder* s = &b->stats;
+    Table* t = b->table;
+    for (UINT i = 0; i < t->nattrs; i++){
+        if (s->nseen == 0 || tuple[i] < t->stats[i].min) t->stats[i].min = tuple[i];
+        if (s->nseen == 0 || tuple[i] > t->stats[i].max) t->stats[i].max = tuple[i];
+
+        // the first HLL_BITS bits of the hash choose the register, which
+        // keeps the longest run of leading zeros seen in the other bits
+        UINT64 h = mix64((UINT64)(UINT)tuple[i]);
+        UINT reg = h >> (64 - HLL_BITS);
+        UINT64 rest = h << HLL_BITS;
+        INT8 rank = rest == 0 ? 64 - HLL_BITS + 1 : __builtin_clzll(rest) + 1;
+        INT8* r = &s->hll[(size_t)i*HLL_NREGISTERS + reg];
+        if (rank > *r) *r = rank;
+    }
+
+    // reservoir sampling, the n-th tuple replaces a random one of the
+    // sample with probability STATS_SAMPLE_SIZE / n
+    s->nseen++;
+    UINT64 slot = s->nsampled;
+    if (s->nsampled == STATS_SAMPLE_SIZE){
+        s->rand = mix64(s->rand + s->nseen);
+        slot = s->rand % s->nseen;
+        if (slot >= STATS_SAMPLE_SIZE) return;
+    }
+    else{
+        s->nsampled++;
+    }
+    memcpy(s->sample + slot*t->nattrs, tuple, sizeof(INT)*t->nattrs);
+}
+
+static int cmp_int(const void* a, const void* b){
+    INT x = *(const INT*)a;
+    INT y = *(const INT*)b;
+    return (x > y) - (x < y);
+}
+
+// estimate the number of distinct values from hyperloglog registers,
+// small counts use linear counting over the empty registers
+static UINT64 hll_estimate(const INT8* registers){
+    double sum = 0;
+    UINT nzeros = 0;
+    for (UINT j = 0; j < HLL_NREGISTERS; j++){
+        sum += ldexp(1.0, -registers[j]);
+        if (registers[j] == 0) nzeros++;
+    }
+    double m = HLL_NREGISTERS;
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && nzeros > 0){
+        estimate = m * log(m / nzeros);
+    }
+    return (UINT64)(estimate + 0.5);
+}
+
+// turn the sketches and the sample into statistics of each attribute
+static void finish_stats(Page_builder* b){
+    Stats_builder* s = &b->stats;
+    Table* t = b->table;
+    if (t->ntuples == 0){
+        free(t->stats);
+        t->stats = NULL;
+    }
+    else{
+        INT* column = malloc(sizeof(INT)*s->nsampled);
+        for (UINT i = 0; i < t->nattrs; i++){
+            Attr_stats* st = &t->stats[i];
+            for (UINT64 k = 0; k < s->nsampled; k++){
+                column[k] = s->sample[k*t->nattrs + i];
+            }
+            qsort(column, s->nsampled, sizeof(INT), cmp_int);
+
+            // the sample is the whole table, count distinct values exactly
+            if (s->nsampled == t->ntuples){
+                st->ndv = 1;
+                for (UINT64 k = 1; k < s->nsampled; k++){
+                    if (column[k] != column[k-1]) st->ndv++;
+                }
+            }
+            else{
+                st->ndv = hll_estimate(s->hll + (size_t)i*HLL_NREGISTERS);
+                if (st->ndv > t->ntuples) st->ndv = t->ntuples;
+                if (st->ndv == 0) st->ndv = 1;
+            }
+
+            // bucket boundaries at evenly spaced ranks of the sample, the
+            // first and last one are the true min and max
+            for (UINT k = 0; k <= HIST_NBUCKETS; k++){
+                st->bounds[k] = column[(s->nsampled - 1) * k / HIST_NBUCKETS];
+            }
+            st->bounds[0] = st->min;
+            st->bounds[HIST_NBUCKETS] = st->max;
+        }
+        free(column);
+    }
+    free(s->hll);
+    free(s->sample);
+}
+
+double range_selectivity(const Attr_stats* stats, int64_t lo, int64_t hi){
+    if (stats == NULL) return 1;
+    if (lo < stats->min) lo = stats->min;
+    if (hi > stats->max) hi = stats->max;
+    if (lo > hi) return 0;
+
+    // values are assumed to be spread evenly within a bucket
+    double fraction = 0;
+    for (UINT k = 0; k < HIST_NBUCKETS; k++){
+        int64_t low = stats->bounds[k];
+        int64_t high = stats->bounds[k+1];
+        int64_t from = lo > low ? lo : low;
+        int64_t to = hi < high ? hi : high;
+        if (from <= to){
+            fraction += (double)(to - from + 1) / (high - low + 1) / HIST_NBUCKETS;
+        }
+    }
+    return fraction < 1 ? fraction : 1;
+}
+
+double eq_selectivity(const Attr_stats* stats, int64_t value){
+    if (stats == NULL) return 1;
+    if (value < stats->min || value > stats->max) return 0;
+
+    // a value filling whole buckets is more frequent than the average one
+    double fraction = 1.0 / stats->ndv;
+    double in_buckets = range_selectivity(stats, value, value);
+    return in_buckets > fraction ? in_buckets : fraction;
+}
+
+// start writing pages of a new table, the table is already in the catalog
+static void start_table(Page_builder* b, Table* t){
+    // produce table file path
+    char table_path[PATH_MAX];
+    if (t->tablespace != NULL){
+        make_folder("Tablespace",t->tablespace);
+    }
+    file_path(t->oid,table_path,sizeof(table_path));
+
+    // open file pointer for the table
+    b->fp = fopen(table_path,"wb");
+    if (b->fp == NULL){
+        perror("Fail to open the table file.\n");
         exit(-1);
     }
 
+    // calculate number of tuples per page
+    b->nattrs = t->nattrs;
+    b->ntuples_per_page = (cf->page_size-sizeof(UINT64))/sizeof(INT)/t->nattrs;
+    if (b->ntuples_per_page == 0){
+        printf("Page size %u is too small for table %s.\n",cf->page_size,t->name);
+        exit(-1);
+    }
 
+    b->page = calloc(cf->page_size, 1);
+    b->processed_ntuples = 0;
+    b->prev_tuple = malloc(sizeof(INT)*t->nattrs);
+    b->has_prev = false;
 
-    // file pointer to write tuples 
-    FILE* table_fp = NULL;
+    b->table = t;
+    t->npages = 0;
+    t->pids = NULL;
+    b->pids_capacity = 0;
+    t->stats = calloc(t->nattrs, sizeof(Attr_stats));
+    start_stats(&b->stats, t->nattrs);
 
-    
-    
-    
-    INT table_idx = -1;
-    INT ntuples_per_page = 0;
-    INT nbytes_free = 0;
+    // reset page id
+    b->page_id = 0;
+}
 
-    INT processed_ntuples = 0;
+// write the page being assembled, the rest of page is padded with 0
+static void flush_page(Page_builder* b){
+    if (b->processed_ntuples == 0) return;
+
+    // write a page id to the head of page
+    UINT64 new_page_id = b->page_id*10 + 100;
+    memcpy(b->page, &new_page_id, sizeof(UINT64));
+    fwrite(b->page, cf->page_size, 1, b->fp);
+
+    // remember where the page is, so the page directory of the table is
+    // read from the catalog instead of from the header of every page
+    Table* t = b->table;
+    if (b->page_id == b->pids_capacity){
+        b->pids_capacity = b->pids_capacity == 0 ? 64 : b->pids_capacity*2;
+        UINT64* pids = realloc(t->pids, sizeof(UINT64)*b->pids_capacity);
+        if (pids == NULL){
+            printf("Fail to allocate the page directory of table %s.\n",t->name);
+            exit(-1);
+        }
+        t->pids = pids;
+    }
+    t->pids[b->page_id] = new_page_id;
+    ++b->page_id;
 
-    UINT64 page_id = 0;
-    Table t;
-    
-    char line[100];
-    while(fgets(line,100,input_fp)){
+    memset(b->page, 0, cf->page_size);
+    b->processed_ntuples = 0;
+}
+
+// append a tuple to current page, write the page when it is full
+static inline INT* next_tuple(Page_builder* b){
+    INT* tuple = (INT*)(b->page + sizeof(UINT64)) + (size_t)b->processed_ntuples*b->nattrs;
+    ++b->processed_ntuples;
+    return tuple;
+}
+
+// clear the bit of each attribute which is smaller than in the previous
+// tuple, and add the tuple to the statistics
+static inline void track_order(Page_builder* b, const INT* tuple){
+    Table* t = b->table;
+    collect_stats(b, tuple);
+    if (b->has_prev){
+        UINT n = t->nattrs < 64 ? t->nattrs : 64;
+        for (UINT i = 0; i < n; i++){
+            if (tuple[i] < b->prev_tuple[i]) t->sorted_attrs &= ~((UINT64)1 << i);
+        }
+    }
+    memcpy(b->prev_tuple, tuple, sizeof(INT)*t->nattrs);
+    b->has_prev = true;
+}
+
+static inline void end_tuple(Page_builder* b){
+    if (b->processed_ntuples == b->ntuples_per_page) flush_page(b);
+}
+
+static void finish_table(Page_builder* b){
+    if (b->fp == NULL) return;
+    flush_page(b);
+    b->table->npages = b->page_id;
+    fclose(b->fp);
+    free(b->page);
+    free(b->prev_tuple);
+    finish_stats(b);
+    b->fp = NULL;
+}
+
+// load a text input file, one tuple per line, a table may name the folder
+// it is stored in after its number of attributes:
+// table_meta oid name nattrs [tablespace]
+static void load_text(Reader* r, const char* data_path){
+    Page_builder b = {0};
+    INT table_idx = -1;
+
+    int c;
+    while((c = peek_char(r)) != -1){
         
         // lines to write comments
-        if(line[0] == '#') continue;
+        if(c == '#'){
+            skip_line(r);
+            continue;
+        }
         
         // line for database meta info
-        if(line[0] == 'd'){
-            UINT ntables;
+        if(c == 'd'){
             char desc[50];
+            INT ntables = 0;
             
             // get number of tables
-            sscanf(line,"%s %d",desc,&ntables);
+            read_word(r,desc,sizeof(desc));
+            read_int(r,&ntables);
+            skip_line(r);
 
-            
-            
             // initialize Database instance
             db = malloc(sizeof(Database)+ntables*sizeof(Table));
             db->ntables = ntables;
-            strcpy(db->path,data_path);
-
-            // printf("data path: %s\n",db->path);
-            
-            
+            set_db_path(data_path);
+            db->nindexes = 0;
+            db->indexes = NULL;
             continue;
         }
 
         // line for table meta info
-        if(line[0] == 't'){
-
-            ++table_idx;
-
+        if(c == 't'){
             // close the old one if exists
-            if(table_idx > 0){
-                // the current table is not the first
-
-                if(processed_ntuples != 0){
-                    // the last page is not full
-                    // add 0 to the end
-                    INT8 f = 0;
-                    UINT left_space = sizeof(INT)*t.nattrs*(ntuples_per_page-processed_ntuples)+nbytes_free;
-                    
-                    for (UINT i = 0; i < left_space; i++) fwrite(&f,sizeof(INT8),1,table_fp);
-                
-
-                    processed_ntuples = 0;
-                }
-                
-                fclose(table_fp);
-
-            }
-
-
-
-            char desc[50];
+            finish_table(&b);
+            ++table_idx;
 
             // initialzie a table instance
-            // Table t;
-            sscanf(line,"%s %u %s %u",desc,&t.oid,t.name,&t.nattrs);
+            Table t;
+            char desc[50];
+            INT value = 0;
+            read_word(r,desc,sizeof(desc));
+            read_int(r,&value);
+            t.oid = value;
+            read_word(r,t.name,sizeof(t.name));
+            read_int(r,&value);
+            t.nattrs = value;
             t.ntuples = 0;
-            
+            t.sorted_attrs = all_sorted(t.nattrs);
+            t.stats = NULL;
+            t.pids = NULL;
+            char tablespace[PATH_MAX];
+            read_word(r,tablespace,sizeof(tablespace));
+            t.tablespace = tablespace[0] != '\0' ? strdup(tablespace) : NULL;
+            skip_line(r);
             
             // add the table pointer to the DB instance
             db->tables[table_idx] = t;
 
-
-            
-            // produce table file path
-            char table_path[200];
-            sprintf(table_path,"%s/%u",db->path,t.oid);
-            // open file pointer for the table
-            table_fp = fopen(table_path,"wb");
-            
-
-            // reset page id
-            page_id = 0;
-            
-            
-            // calculate number of tuples per page
-            ntuples_per_page = (cf->page_size-sizeof(UINT64))/sizeof(INT)/t.nattrs;
-            nbytes_free = (cf->page_size-sizeof(UINT64)) % (sizeof(INT)*t.nattrs);
-            // printf("ntuples = %u, free bytes = %u\n",ntuples_per_page,nbytes_free);
-
-            processed_ntuples = 0;
-            
+            start_table(&b,&db->tables[table_idx]);
             continue;
         }
+
         // skip empty lines
-        if(!isdigit(line[0])) continue;
+        if(!isdigit(c) && c != '-'){
+            skip_line(r);
+            continue;
+        }
 
-        // we are processing the first tuple for a page
-        if(processed_ntuples == 0){
-            // write a page id to the file
-            UINT64 new_page_id = page_id*10 + 100;
-            fwrite(&new_page_id,sizeof(UINT64),1,table_fp);
-            ++page_id;
+        // parse the tuple straight into the page being assembled,
+        // attributes missing at the end of line are 0
+        INT* tuple = next_tuple(&b);
+        for (UINT i = 0; i < b.nattrs; i++){
+            if (!read_int(r,&tuple[i])) break;
         }
-        ++processed_ntuples;
+        skip_line(r);
         ++db->tables[table_idx].ntuples;
-        // printf("processed tuples = %u, tuples per page = %u\n",processed_ntuples,ntuples_per_page);
+        track_order(&b,tuple);
+        end_tuple(&b);
+    }
 
+    finish_table(&b);
+}
 
-        // write tuple to file
-        // assume each table has only one file
-        
-        char* token = strtok(line," ");
-        
-        INT attr;
-        while(token != NULL){
-            
-            // read each attribute and write it to the hard drive
-            sscanf(token,"%d",&attr);
-            
-            fwrite(&attr,sizeof(INT),1,table_fp);
-            
-            token = strtok(NULL," ");
-        }
+// load a binary input file, which stores the magic number, number of tables,
+// then for each table its oid, name, number of attributes, number of tuples
+// and all attributes of its tuples, the tuples are copied into pages directly
+static void load_binary(Reader* r, const char* data_path){
+    Page_builder b = {0};
 
-        
-        
-        // when the derived number of tuples reaches the maximum number of tuples per page
-        // we add 0 to the end if necessary
-        if(processed_ntuples == ntuples_per_page){
-            INT8 f = 0;
-            for (UINT i = 0; i < nbytes_free; i++) fwrite(&f,sizeof(INT8),1,table_fp);
-            processed_ntuples = 0;
+    // the rest of the file is read by fread, drop what the reader has buffered
+    fseek(r->fp, strlen(BINARY_MAGIC), SEEK_SET);
 
+    UINT ntables;
+    if (fread(&ntables,sizeof(UINT),1,r->fp) != 1){
+        printf("Fail to read the binary input data file.\n");
+        exit(-1);
+    }
+    db = malloc(sizeof(Database)+ntables*sizeof(Table));
+    db->ntables = ntables;
+    set_db_path(data_path);
+    db->nindexes = 0;
+    db->indexes = NULL;
+
+    for (UINT i = 0; i < ntables; i++){
+        Table t;
+        if (fread(&t.oid,sizeof(UINT),1,r->fp) != 1
+            || fread(t.name,sizeof(t.name),1,r->fp) != 1
+            || fread(&t.nattrs,sizeof(UINT),1,r->fp) != 1
+            || fread(&t.ntuples,sizeof(UINT),1,r->fp) != 1){
+            printf("Fail to read the binary input data file.\n");
+            exit(-1);
         }
+        t.name[sizeof(t.name)-1] = '\0';
+        t.sorted_attrs = all_sorted(t.nattrs);
+        t.stats = NULL;
+        t.pids = NULL;
+        t.tablespace = NULL;
+        db->tables[i] = t;
+
+        start_table(&b,&db->tables[i]);
+
+        // read as many tuples as one page holds with one fread
+        UINT left = t.ntuples;
+        while (left > 0){
+            UINT n = b.ntuples_per_page < left ? b.ntuples_per_page : left;
+            if (fread(b.page + sizeof(UINT64), sizeof(INT)*t.nattrs, n, r->fp) != n){
+                printf("Fail to read the binary input data file.\n");
+                exit(-1);
+            }
+            for (UINT k = 0; k < n; k++){
+                track_order(&b,(INT*)(b.page + sizeof(UINT64)) + (size_t)k*t.nattrs);
+            }
+            b.processed_ntuples = n;
+            flush_page(&b);
+            left -= n;
+        }
+        finish_table(&b);
+    }
+}
+
+// build database
+Database* init_db(char* input_data_path, char* data_path){
+    
+    
+    // check if db folder exists
+    make_folder("Database",data_path);
+
+    
+    db = NULL;
+
+    
+    // open the input data file
+    FILE* input_fp = fopen(input_data_path,"rb");
+    printf("Input data path:%s\n",input_data_path);
+    if (input_fp == NULL){
+        perror("Fail to open the input data file.\n");
+        exit(-1);
     }
 
-    if(processed_ntuples != 0){
-        // the last page is not full
-        // add 0 to the end
-        INT8 f = 0;
-        UINT left_space = sizeof(INT)*t.nattrs*(ntuples_per_page-processed_ntuples)+nbytes_free;
-        for (UINT i = 0; i < left_space; i++) fwrite(&f,sizeof(INT8),1,table_fp);
-        processed_ntuples = 0;
+    Reader r;
+    r.fp = input_fp;
+    r.buf = malloc(LOAD_BUFFER_SIZE);
+    r.len = fread(r.buf, 1, LOAD_BUFFER_SIZE, input_fp);
+    r.pos = 0;
+
+    // binary input skips text parsing entirely
+    size_t magic_len = strlen(BINARY_MAGIC);
+    if (r.len >= magic_len && memcmp(r.buf, BINARY_MAGIC, magic_len) == 0){
+        load_binary(&r,data_path);
     }
-    
-    fclose(table_fp);
+    else{
+        load_text(&r,data_path);
+    }
+
+    free(r.buf);
     fclose(input_fp);
 
+    save_catalog();
+
+    return db;
+}
+
+void save_catalog(){
+    // write a new catalog next to the old one and rename it over the old
+    // one, so a crash never leaves a half written catalog
+    char catalog_path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    make_path(catalog_path,sizeof(catalog_path),db->path,CATALOG_FILE);
+    make_path(tmp_path,sizeof(tmp_path),db->path,CATALOG_FILE ".tmp");
+    FILE* fp = fopen(tmp_path,"wb");
+    if (fp == NULL){
+        perror("Fail to open the catalog file.\n");
+        exit(-1);
+    }
+
+    bool ok = fwrite(CATALOG_MAGIC,strlen(CATALOG_MAGIC),1,fp) == 1
+              && fwrite(&cf->page_size,sizeof(UINT),1,fp) == 1
+              && fwrite(&db->ntables,sizeof(UINT),1,fp) == 1;
+    for (UINT i = 0; ok && i < db->ntables; i++){
+        const Table* t = &db->tables[i];
+        UINT has_stats = t->stats != NULL;
+        UINT tablespace_len = t->tablespace != NULL ? strlen(t->tablespace) : 0;
+        ok = fwrite(&t->oid,sizeof(UINT),1,fp) == 1
+             && fwrite(t->name,sizeof(t->name),1,fp) == 1
+             && fwrite(&t->nattrs,sizeof(UINT),1,fp) == 1
+             && fwrite(&t->ntuples,sizeof(UINT),1,fp) == 1
+             && fwrite(&t->npages,sizeof(UINT64),1,fp) == 1
+             && (t->npages == 0 || fwrite(t->pids,sizeof(UINT64),t->npages,fp) == t->npages)
+             && fwrite(&t->sorted_attrs,sizeof(UINT64),1,fp) == 1
+             && fwrite(&has_stats,sizeof(UINT),1,fp) == 1
+             && (!has_stats || fwrite(t->stats,sizeof(Attr_stats),t->nattrs,fp) == t->nattrs)
+             && fwrite(&tablespace_len,sizeof(UINT),1,fp) == 1
+             && (tablespace_len == 0 || fwrite(t->tablespace,tablespace_len,1,fp) == 1);
+    }
+    ok = ok && fwrite(&db->nindexes,sizeof(UINT),1,fp) == 1
+         && (db->nindexes == 0 || fwrite(db->indexes,sizeof(Index),db->nindexes,fp) == db->nindexes);
+
+    if (fclose(fp) != 0 || !ok || rename(tmp_path,catalog_path) != 0){
+        printf("Fail to write the catalog file %s.\n",catalog_path);
+        exit(-1);
+    }
+}
+
+// read n items of size bytes from the catalog, exit if the file is too short
+static void read_catalog(FILE* fp, void* ptr, size_t size, size_t n){
+    if (n > 0 && fread(ptr,size,n,fp) != n){
+        printf("Fail to read the catalog file.\n");
+        exit(-1);
+    }
+}
+
+Database* open_db(char* data_path){
+    char catalog_path[PATH_MAX];
+    make_path(catalog_path,sizeof(catalog_path),data_path,CATALOG_FILE);
+    FILE* fp = fopen(catalog_path,"rb");
+    printf("Open database:%s\n",data_path);
+    if (fp == NULL){
+        perror("Fail to open the catalog file.\n");
+        exit(-1);
+    }
+
+    char magic[sizeof(CATALOG_MAGIC)] = {0};
+    UINT catalog_page_size;
+    UINT ntables;
+    read_catalog(fp,magic,strlen(CATALOG_MAGIC),1);
+    if (strcmp(magic,CATALOG_MAGIC) != 0){
+        printf("%s is not a catalog file.\n",catalog_path);
+        exit(-1);
+    }
+    read_catalog(fp,&catalog_page_size,sizeof(UINT),1);
+    read_catalog(fp,&ntables,sizeof(UINT),1);
+
+    // tuples are laid out in pages of the size the database was loaded with
+    if (catalog_page_size != cf->page_size){
+        printf("The database was created with page size %u, not %u.\n",catalog_page_size,cf->page_size);
+        exit(-1);
+    }
+
+    db = malloc(sizeof(Database)+ntables*sizeof(Table));
+    db->ntables = ntables;
+    set_db_path(data_path);
+    db->nindexes = 0;
+    db->indexes = NULL;
+
+    for (UINT i = 0; i < ntables; i++){
+        Table* t = &db->tables[i];
+        UINT has_stats;
+        read_catalog(fp,&t->oid,sizeof(UINT),1);
+        read_catalog(fp,t->name,sizeof(t->name),1);
+        read_catalog(fp,&t->nattrs,sizeof(UINT),1);
+        read_catalog(fp,&t->ntuples,sizeof(UINT),1);
+        read_catalog(fp,&t->npages,sizeof(UINT64),1);
+        t->pids = malloc(sizeof(UINT64)*(t->npages > 0 ? t->npages : 1));
+        read_catalog(fp,t->pids,sizeof(UINT64),t->npages);
+        read_catalog(fp,&t->sorted_attrs,sizeof(UINT64),1);
+        read_catalog(fp,&has_stats,sizeof(UINT),1);
+        t->name[sizeof(t->name)-1] = '\0';
+        t->stats = NULL;
+        if (has_stats){
+            t->stats = malloc(sizeof(Attr_stats)*t->nattrs);
+            read_catalog(fp,t->stats,sizeof(Attr_stats),t->nattrs);
+        }
+
+        UINT tablespace_len;
+        read_catalog(fp,&tablespace_len,sizeof(UINT),1);
+        t->tablespace = NULL;
+        if (tablespace_len > 0){
+            t->tablespace = calloc(tablespace_len + 1, 1);
+            read_catalog(fp,t->tablespace,tablespace_len,1);
+        }
+    }
+
+    read_catalog(fp,&db->nindexes,sizeof(UINT),1);
+    db->indexes = malloc(sizeof(Index)*(db->nindexes > 0 ? db->nindexes : 1));
+    read_catalog(fp,db->indexes,sizeof(Index),db->nindexes);
+    fclose(fp);
+
+    // the table file must hold as many pages as the catalog says
+    for (UINT i = 0; i < ntables; i++){
+        const Table* t = &db->tables[i];
+        char table_path[PATH_MAX];
+        struct stat st;
+        file_path(t->oid,table_path,sizeof(table_path));
+        if (stat(table_path,&st) == -1 || (UINT64)st.st_size != t->npages*cf->page_size){
+            printf("Table file %s is missing or does not match the catalog.\n",table_path);
+            exit(-1);
+        }
+    }
+
     return db;
 }
 
@@ -231,7 +861,14 @@ void log_read_page(UINT64 pid){
     // the following print info is for testing
     // comment it out to avoid too much output in terminal when developing
     // printf("Read page %lu\n",pid);
-    cf->read_io ++;
+    // pages may be read by several threads at once
+    __atomic_add_fetch(&cf->read_io, 1, __ATOMIC_RELAXED);
+}
+void log_write_page(UINT64 pid){
+    // the following print info is for testing
+    // comment it out to avoid too much output in terminal when developing
+    // printf("Write page %lu\n",pid);
+    __atomic_add_fetch(&cf->write_io, 1, __ATOMIC_RELAXED);
 }
 void log_release_page(UINT64 pid){
     // the following print info is for testing
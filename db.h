@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <limits.h>
 
 
 #define INT int32_t
@@ -13,24 +14,69 @@
 #define Tuple INT*
 
 // returned data type by relational operators
+// all tuples are stored in one contiguous block right after the array of
+// tuple pointers, tuples[i] points to the i-th row of that block, so the
+// whole table is released with a single free
 typedef struct _Table{
     UINT nattrs;
     UINT ntuples;
     Tuple tuples[];
 } _Table;
 
+// the contiguous block of tuples, row after row
+static inline INT* table_data(const _Table* t){
+    return (INT*)(t->tuples + t->ntuples);
+}
+
+// the j-th attribute of the i-th tuple
+static inline INT table_attr(const _Table* t, UINT i, UINT j){
+    return table_data(t)[(size_t)i*t->nattrs + j];
+}
+
+// number of buckets of the equi-depth histogram of each attribute
+#define HIST_NBUCKETS 16
+
+// statistics of one attribute gathered while the table is loaded
+typedef struct Attr_stats{
+    INT min;
+    INT max;
+    UINT64 ndv;             // estimated number of distinct values
+    INT bounds[HIST_NBUCKETS + 1];  // bucket i holds values in [bounds[i], bounds[i+1]],
+                                    // each bucket holds about the same number of tuples
+} Attr_stats;
+
 // internal table meta information
 typedef struct Table{
     UINT oid;
     char name[10];
     UINT nattrs;
     UINT ntuples;
+    UINT64 npages;          // number of pages in the table file
+    UINT64* pids;           // page id of each page of the table file, in file order
+    UINT64 sorted_attrs;    // bit i is set if attribute i (i < 64) is in non-decreasing order
+    Attr_stats* stats;      // statistics of each attribute, NULL if the table is empty
+    char* tablespace;       // folder of the table file and its indexes, NULL for the database folder
 } Table;
 
+// B+-tree secondary index over one attribute of a table, stored in its own
+// file of the database folder next to the table files
+typedef struct Index{
+    UINT oid;               // oid of the index file
+    UINT table_oid;         // oid of the indexed table
+    UINT idx;               // index of the indexed attribute
+    UINT height;            // number of levels, 1 if the root is a leaf
+    UINT64 root;            // page of the root node
+    UINT64 npages;          // number of pages in the file
+    UINT64 nleaves;         // leaves are the first nleaves pages
+    UINT64 nentries;        // number of indexed tuples
+} Index;
+
 // internal database meta information
 typedef struct Database {
     UINT ntables;
-    char path[100];
+    char path[PATH_MAX];
+    UINT nindexes;
+    Index* indexes;
     Table tables[];
 } Database;
 
@@ -41,28 +87,54 @@ typedef struct Conf{
     UINT page_size;
     UINT buf_slots;
     UINT file_limit;
-    char buf_policy[4];
+    char buf_policy[8];
+    UINT smgr;              // storage manager backend, one of SMGR_* in smgr.h
+    UINT ring_slots;        // most buffer slots a large sequential scan may use, 0 for no limit
+    UINT prefetch_depth;    // pages a sequential scan reads ahead in the background, 0 for none
+    UINT parallel_workers;  // threads scanning a table for a selection, 1 for no parallel scan
 } Conf;
 
 
 
 // declaration for functions in db.c
 
+_Table* new_table(UINT nattrs, UINT ntuples);
+
 Conf* init_conf(const UINT page_size, const UINT buf_slots, const UINT file_limit, const char* buf_policy);
 void free_conf();
 Conf* get_conf();
 
 Database* init_db(char* input_data_path, char* data_path);
+// open a database written by an earlier run from the catalog in its folder
+Database* open_db(char* data_path);
+// write tables, statistics and indexes to the catalog in the database folder
+void save_catalog();
 Database* get_db();
 void free_db();
 
+// path of file name in a folder, exit if it does not fit in size bytes
+void make_path(char* path, size_t size, const char* folder, const char* name);
+
+// path of the file of a table or an index, which is in the tablespace of
+// the table or in the database folder
+void file_path(UINT oid, char* path, size_t size);
+
+// add an index to the catalog, the oid is not used by any table or index
+Index* add_index(UINT table_oid, UINT idx);
+// find the index over attribute idx of a table, NULL if there is none
+Index* find_index(UINT table_oid, UINT idx);
+
+// estimated fraction of tuples whose attribute is in [lo, hi], or equal to
+// value, 1 if there are no statistics
+double range_selectivity(const Attr_stats* stats, int64_t lo, int64_t hi);
+double eq_selectivity(const Attr_stats* stats, int64_t value);
+
 void reset_IO();
 void log_read_page(UINT64 pid);
 void log_release_page(UINT64 pid);
 void log_open_file(UINT oid);
 void log_close_file(UINT oid);
-
-// void log_write_page(UINT64 pid);
+void log_write_page(UINT64 pid);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include "filter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_X86
+#endif
+
+// kernels and instruction set chosen by init_filter
+static Filter_fn kernels[NCMP];
+static const char* isa = NULL;
+
+// write the index of each set bit of mask, base is the index of bit 0
+static inline UINT emit_mask(UINT mask, UINT base, UINT* sel_vec){
+    UINT n = 0;
+    while (mask != 0){
+        sel_vec[n++] = base + __builtin_ctz(mask);
+        mask &= mask - 1;
+    }
+    return n;
+}
+
+// scalar test of each operator on attribute value a
+#define EQ_SCALAR(a) ((a) == lo)
+#define NE_SCALAR(a) ((a) != lo)
+#define LT_SCALAR(a) ((a) < lo)
+#define LE_SCALAR(a) ((a) <= lo)
+#define GT_SCALAR(a) ((a) > lo)
+#define GE_SCALAR(a) ((a) >= lo)
+#define BETWEEN_SCALAR(a) (((a) >= lo) & ((a) <= hi))
+
+// op_from compares tuples from the from-th one to the end, one at a time,
+// it is also the tail of the vector kernels
+#define SCALAR_KERNEL(op, TEST) \
+static inline UINT op##_from(const INT* attr, UINT from, UINT ntuples, UINT nattrs, INT lo, INT hi, UINT* sel_vec){ \
+    (void)hi; \
+    UINT n = 0; \
+    for (UINT i = from; i < ntuples; i++){ \
+        /* branch free, the index is always written and kept only on a match */ \
+        INT a = attr[(size_t)i*nattrs]; \
+        sel_vec[n] = i; \
+        n += TEST(a); \
+    } \
+    return n; \
+} \
+static UINT op##_scalar(const INT* tuples, UINT ntuples, UINT nattrs, UINT idx, INT lo, INT hi, UINT* sel_vec){ \
+    return op##_from(tuples + idx, 0, ntuples, nattrs, lo, hi, sel_vec); \
+}
+
+// op_split tests the tuples listed in in, one at a time
+#define SPLIT_KERNEL(op, TEST) \
+static UINT op##_split(const INT* tuples, UINT nattrs, UINT idx, INT lo, INT hi, const UINT* in, UINT nin, UINT* hit, UINT* miss){ \
+    (void)hi; \
+    const INT* attr = tuples + idx; \
+    UINT nhit = 0; \
+    UINT nmiss = 0; \
+    for (UINT k = 0; k < nin; k++){ \
+        /* branch free, the index is written to both and kept by one */ \
+        UINT i = in[k]; \
+        UINT m = TEST(attr[(size_t)i*nattrs]); \
+        hit[nhit] = i; \
+        miss[nmiss] = i; \
+        nhit += m; \
+        nmiss += 1 - m; \
+    } \
+    return nhit; \
+}
+
+SCALAR_KERNEL(eq, EQ_SCALAR)
+SCALAR_KERNEL(ne, NE_SCALAR)
+SCALAR_KERNEL(lt, LT_SCALAR)
+SCALAR_KERNEL(le, LE_SCALAR)
+SCALAR_KERNEL(gt, GT_SCALAR)
+SCALAR_KERNEL(ge, GE_SCALAR)
+SCALAR_KERNEL(between, BETWEEN_SCALAR)
+
+static const Filter_fn scalar_kernels[NCMP] = {
+    eq_scalar, ne_scalar, lt_scalar, le_scalar, gt_scalar, ge_scalar, between_scalar
+};
+
+SPLIT_KERNEL(eq, EQ_SCALAR)
+SPLIT_KERNEL(ne, NE_SCALAR)
+SPLIT_KERNEL(lt, LT_SCALAR)
+SPLIT_KERNEL(le, LE_SCALAR)
+SPLIT_KERNEL(gt, GT_SCALAR)
+SPLIT_KERNEL(ge, GE_SCALAR)
+SPLIT_KERNEL(between, BETWEEN_SCALAR)
+
+// tuples listed in a selection vector are scattered over the page, so split
+// kernels are scalar for every instruction set
+static const Split_fn split_kernels[NCMP] = {
+    eq_split, ne_split, lt_split, le_split, gt_split, ge_split, between_split
+};
+
+#ifdef FILTER_X86
+
+// lane masks of each operator on vector x, l and h hold lo and hi in every
+// lane, only == and > exist for integers so the others are complements
+#define SSE_MASK(v) _mm_movemask_ps(_mm_castsi128_ps(v))
+#define EQ_SSE(x) SSE_MASK(_mm_cmpeq_epi32(x, l))
+#define NE_SSE(x) (SSE_MASK(_mm_cmpeq_epi32(x, l)) ^ 0xF)
+#define LT_SSE(x) SSE_MASK(_mm_cmpgt_epi32(l, x))
+#define LE_SSE(x) (SSE_MASK(_mm_cmpgt_epi32(x, l)) ^ 0xF)
+#define GT_SSE(x) SSE_MASK(_mm_cmpgt_epi32(x, l))
+#define GE_SSE(x) (SSE_MASK(_mm_cmpgt_epi32(l, x)) ^ 0xF)
+#define BETWEEN_SSE(x) (SSE_MASK(_mm_or_si128(_mm_cmpgt_epi32(l, x), _mm_cmpgt_epi32(x, h))) ^ 0xF)
+
+#define AVX_MASK(v) _mm256_movemask_ps(_mm256_castsi256_ps(v))
+#define EQ_AVX(x) AVX_MASK(_mm256_cmpeq_epi32(x, l))
+#define NE_AVX(x) (AVX_MASK(_mm256_cmpeq_epi32(x, l)) ^ 0xFF)
+#define LT_AVX(x) AVX_MASK(_mm256_cmpgt_epi32(l, x))
+#define LE_AVX(x) (AVX_MASK(_mm256_cmpgt_epi32(x, l)) ^ 0xFF)
+#define GT_AVX(x) AVX_MASK(_mm256_cmpgt_epi32(x, l))
+#define GE_AVX(x) (AVX_MASK(_mm256_cmpgt_epi32(l, x)) ^ 0xFF)
+#define BETWEEN_AVX(x) (AVX_MASK(_mm256_or_si256(_mm256_cmpgt_epi32(l, x), _mm256_cmpgt_epi32(x, h))) ^ 0xFF)
+
+// sse2 kernel takes 4 tuples per step, the attribute of each tuple is loaded
+// separately because tuples of a page are stored row by row
+// avx2 kernel takes 8 tuples per step, the attribute is gathered with a
+// stride of nattrs
+#define VECTOR_KERNELS(op, SSE, AVX) \
+__attribute__((target("sse2"))) \
+static UINT op##_sse2(const INT* tuples, UINT ntuples, UINT nattrs, UINT idx, INT lo, INT hi, UINT* sel_vec){ \
+    UINT n = 0; \
+    const INT* attr = tuples + idx; \
+    __m128i l = _mm_set1_epi32(lo); \
+    __m128i h = _mm_set1_epi32(hi); \
+    (void)h; \
+    UINT i = 0; \
+    for (; i + 4 <= ntuples; i += 4){ \
+        const INT* a = attr + (size_t)i*nattrs; \
+        __m128i x = _mm_set_epi32(a[3*nattrs], a[2*nattrs], a[nattrs], a[0]); \
+        n += emit_mask(SSE(x), i, sel_vec + n); \
+    } \
+    return n + op##_from(attr, i, ntuples, nattrs, lo, hi, sel_vec + n); \
+} \
+__attribute__((target("avx2"))) \
+static UINT op##_avx2(const INT* tuples, UINT ntuples, UINT nattrs, UINT idx, INT lo, INT hi, UINT* sel_vec){ \
+    UINT n = 0; \
+    const INT* attr = tuples + idx; \
+    __m256i l = _mm256_set1_epi32(lo); \
+    __m256i h = _mm256_set1_epi32(hi); \
+    (void)h; \
+    __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(nattrs)); \
+    UINT i = 0; \
+    for (; i + 8 <= ntuples; i += 8){ \
+        const INT* a = attr + (size_t)i*nattrs; \
+        __m256i x = nattrs == 1 ? _mm256_loadu_si256((const __m256i*)a) : _mm256_i32gather_epi32(a, offsets, 4); \
+        n += emit_mask(AVX(x), i, sel_vec + n); \
+    } \
+    return n + op##_from(attr, i, ntuples, nattrs, lo, hi, sel_vec + n); \
+}
+
+VECTOR_KERNELS(eq, EQ_SSE, EQ_AVX)
+VECTOR_KERNELS(ne, NE_SSE, NE_AVX)
+VECTOR_KERNELS(lt, LT_SSE, LT_AVX)
+VECTOR_KERNELS(le, LE_SSE, LE_AVX)
+VECTOR_KERNELS(gt, GT_SSE, GT_AVX)
+VECTOR_KERNELS(ge, GE_SSE, GE_AVX)
+VECTOR_KERNELS(between, BETWEEN_SSE, BETWEEN_AVX)
+
+static const Filter_fn sse2_kernels[NCMP] = {
+    eq_sse2, ne_sse2, lt_sse2, le_sse2, gt_sse2, ge_sse2, between_sse2
+};
+
+static const Filter_fn avx2_kernels[NCMP] = {
+    eq_avx2, ne_avx2, lt_avx2, le_avx2, gt_avx2, ge_avx2, between_avx2
+};
+
+#endif
+
+void init_filter(){
+    const Filter_fn* chosen = scalar_kernels;
+    isa = "scalar";
+#ifdef FILTER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+        chosen = avx2_kernels;
+        isa = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2")){
+        chosen = sse2_kernels;
+        isa = "sse2";
+    }
+#endif
+    memcpy(kernels, chosen, sizeof(kernels));
+}
+
+const char* filter_isa(){
+    if (isa == NULL) init_filter();
+    return isa;
+}
+
+Filter_fn filter_kernel(UINT op){
+    if (isa == NULL) init_filter();
+    return kernels[op];
+}
+
+Split_fn split_kernel(UINT op){
+    return split_kernels[op];
+}
+
+void open_filter(Filter* f, const Condition* cond, UINT max_ntuples){
+    f -> cond = *cond;
+    for (UINT k = 0; k < cond -> npreds; k++){
+        f -> full[k] = filter_kernel(cond -> preds[k].op);
+        f -> split[k] = split_kernel(cond -> preds[k].op);
+        f -> order[k] = k;
+        f -> nin[k] = 0;
+        f -> nhit[k] = 0;
+    }
+    f -> in = malloc(sizeof(UINT) * (max_ntuples + 1));
+    f -> out = malloc(sizeof(UINT) * (max_ntuples + 1));
+}
+
+void close_filter(Filter* f){
+    free(f -> in);
+    free(f -> out);
+    f -> in = NULL;
+    f -> out = NULL;
+}
+
+// whether predicate p should be evaluated before predicate q, AND wants
+// the fewest matches first and OR the most, rates are smoothed so that
+// predicates not tested yet are in the middle
+static bool goes_before(const Filter* f, UINT p, UINT q){
+    double rp = (f -> nhit[p] + 1.0) / (f -> nin[p] + 2.0);
+    double rq = (f -> nhit[q] + 1.0) / (f -> nin[q] + 2.0);
+    return f -> cond.conn == CONJ_AND ? rp < rq : rp > rq;
+}
+
+// insertion sort of the evaluation order by observed selectivity
+static void reorder(Filter* f){
+    for (UINT k = 1; k < f -> cond.npreds; k++){
+        UINT p = f -> order[k];
+        UINT j = k;
+        for (; j > 0 && goes_before(f, p, f -> order[j-1]); j--){
+            f -> order[j] = f -> order[j-1];
+        }
+        f -> order[j] = p;
+    }
+}
+
+UINT filter_page(Filter* f, const INT* tuples, UINT ntuples, UINT nattrs, UINT* sel_vec){
+    const Predicate* preds = f -> cond.preds;
+    UINT npreds = f -> cond.npreds;
+    UINT n = 0;
+
+    if (f -> cond.conn == CONJ_AND || npreds == 1){
+        // the first predicate scans the whole page with a vector kernel,
+        // the others only test tuples still selected
+        UINT p = f -> order[0];
+        n = f -> full[p](tuples, ntuples, nattrs, preds[p].idx, preds[p].lo, preds[p].hi, sel_vec);
+        f -> nin[p] += ntuples;
+        f -> nhit[p] += n;
+        for (UINT k = 1; k < npreds && n > 0; k++){
+            p = f -> order[k];
+            f -> nin[p] += n;
+            n = f -> split[p](tuples, nattrs, preds[p].idx, preds[p].lo, preds[p].hi, sel_vec, n, sel_vec, f -> out);
+            f -> nhit[p] += n;
+        }
+    }
+    else{
+        // each predicate only tests tuples not accepted yet, rest keeps
+        // them in page order
+        UINT* rest = f -> in;
+        UINT nrest = ntuples;
+        for (UINT i = 0; i < ntuples; i++){
+            rest[i] = i;
+        }
+        for (UINT k = 0; k < npreds && nrest > 0; k++){
+            UINT p = f -> order[k];
+            f -> nin[p] += nrest;
+            UINT nhit = f -> split[p](tuples, nattrs, preds[p].idx, preds[p].lo, preds[p].hi, rest, nrest, f -> out, rest);
+            f -> nhit[p] += nhit;
+            nrest -= nhit;
+        }
+
+        // matching tuples are those not left in rest
+        UINT j = 0;
+        for (UINT i = 0; i < ntuples; i++){
+            if (j < nrest && rest[j] == i){
+                j++;
+            }
+            else{
+                sel_vec[n++] = i;
+            }
+        }
+    }
+
+    if (npreds > 1){
+        reorder(f);
+    }
+    return n;
+}
+
+UINT filter_list(Filter* f, const INT* tuples, UINT nattrs, UINT* sel_vec, UINT n){
+    const Predicate* preds = f -> cond.preds;
+    UINT npreds = f -> cond.npreds;
+
+    for (UINT k = 0; k < npreds && n > 0; k++){
+        UINT p = f -> order[k];
+        f -> nin[p] += n;
+        n = f -> split[p](tuples, nattrs, preds[p].idx, preds[p].lo, preds[p].hi, sel_vec, n, sel_vec, f -> out);
+        f -> nhit[p] += n;
+    }
+
+    if (npreds > 1){
+        reorder(f);
+    }
+    return n;
+}
+
+UINT parse_conn(const char* token){
+    if (strcasecmp(token, "AND") == 0) return CONJ_AND;
+    if (strcasecmp(token, "OR") == 0) return CONJ_OR;
+    return UNUSED_CMP;
+}
+
+UINT parse_cmp_op(const char* token){
+    if (strcmp(token, "=") == 0 || strcmp(token, "==") == 0) return CMP_EQ;
+    if (strcmp(token, "!=") == 0 || strcmp(token, "<>") == 0) return CMP_NE;
+    if (strcmp(token, "<") == 0) return CMP_LT;
+    if (strcmp(token, "<=") == 0) return CMP_LE;
+    if (strcmp(token, ">") == 0) return CMP_GT;
+    if (strcmp(token, ">=") == 0) return CMP_GE;
+    if (strcasecmp(token, "BETWEEN") == 0) return CMP_BETWEEN;
+    return UNUSED_CMP;
+}
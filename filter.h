@@ -0,0 +1,104 @@
+#ifndef FILTER_H
+#define FILTER_H
+#include "db.h"
+
+// comparison operators of a selection
+#define CMP_EQ 0            // attr == lo
+#define CMP_NE 1            // attr != lo
+#define CMP_LT 2            // attr < lo
+#define CMP_LE 3            // attr <= lo
+#define CMP_GT 4            // attr > lo
+#define CMP_GE 5            // attr >= lo
+#define CMP_BETWEEN 6       // lo <= attr <= hi
+#define NCMP 7
+#define UNUSED_CMP NCMP    // not an operator
+
+// predicate on one attribute
+typedef struct Predicate{
+    UINT idx;               // index of the attribute for comparison
+    UINT op;                // one of CMP_*
+    INT lo;                 // the compared value
+    INT hi;                 // upper bound, only used by CMP_BETWEEN
+}Predicate;
+
+// how predicates of a condition are combined
+#define CONJ_AND 0
+#define CONJ_OR 1
+
+// at most this many predicates in one condition
+#define MAX_PREDS 8
+
+// predicates over one or several attributes, all combined by the same
+// connective, a single predicate is a condition with npreds = 1
+typedef struct Condition{
+    UINT conn;              // CONJ_AND or CONJ_OR
+    UINT npreds;
+    Predicate preds[MAX_PREDS];
+}Condition;
+
+// selection kernels, each compares one attribute of all tuples of a page at
+// once and writes the indices of matching tuples to a selection vector,
+// there is one kernel per operator so no kernel branches on the operator
+
+// tuples: ntuples tuples stored one after another, nattrs attributes each
+// idx: index of the attribute for comparison
+// lo, hi: the compared values, hi is only used by CMP_BETWEEN
+// sel_vec: receives indices of matching tuples, room for ntuples indices
+// return number of matching tuples
+typedef UINT (*Filter_fn)(const INT* tuples, UINT ntuples, UINT nattrs, UINT idx, INT lo, INT hi, UINT* sel_vec);
+
+// split kernels test only the tuples listed in the selection vector in,
+// indices of matching tuples go to hit and the others to miss, both keep
+// the order of in, hit may be the same array as in
+// return number of matching tuples, nin minus it are written to miss
+typedef UINT (*Split_fn)(const INT* tuples, UINT nattrs, UINT idx, INT lo, INT hi, const UINT* in, UINT nin, UINT* hit, UINT* miss);
+
+// evaluation state of a condition over the pages of one table, the
+// predicates are reordered by the selectivity observed so far so that
+// tuples are dropped (AND) or accepted (OR) as early as possible
+typedef struct Filter{
+    Condition cond;
+    Filter_fn full[MAX_PREDS];  // kernels of each predicate
+    Split_fn split[MAX_PREDS];
+    UINT order[MAX_PREDS];  // predicates in evaluation order
+    UINT64 nin[MAX_PREDS];  // tuples tested by each predicate
+    UINT64 nhit[MAX_PREDS]; // tuples matched by each predicate
+    UINT* in;               // scratch selection vectors, one page each
+    UINT* out;
+}Filter;
+
+// choose the kernels for the instruction set supported by current cpu,
+// AVX2 or SSE2 on x86, scalar otherwise
+void init_filter();
+
+// name of the instruction set of chosen kernels
+const char* filter_isa();
+
+// kernel of operator op chosen by init_filter
+Filter_fn filter_kernel(UINT op);
+Split_fn split_kernel(UINT op);
+
+// prepare to evaluate cond over pages of at most max_ntuples tuples
+void open_filter(Filter* f, const Condition* cond, UINT max_ntuples);
+void close_filter(Filter* f);
+
+// evaluate the condition over all tuples of a page in a single pass
+// sel_vec: receives indices of matching tuples in page order, room for
+// ntuples indices
+// return number of matching tuples
+UINT filter_page(Filter* f, const INT* tuples, UINT ntuples, UINT nattrs, UINT* sel_vec);
+
+// evaluate a conjunction over the tuples of a page listed in sel_vec,
+// matching ones are kept in sel_vec in the same order
+// return number of matching tuples
+UINT filter_list(Filter* f, const INT* tuples, UINT nattrs, UINT* sel_vec, UINT n);
+
+// parse a connective token, "AND" or "OR"
+// return CONJ_* of the token, or UNUSED_CMP if it is not a connective
+UINT parse_conn(const char* token);
+
+// parse an operator token, e.g. "<=" or "BETWEEN"
+// return CMP_* of the token, or UNUSED_CMP if it is not an operator
+UINT parse_cmp_op(const char* token);
+
+#endif
@@ -12,38 +12,69 @@
 #include <ctype.h>
 #include "db.h"
 #include "ro.h"
+#include "smgr.h"
+#include "replace.h"
+#include "prefetch.h"
 
 
 void run(char* ra_path, char* log_path);
 void freeT(_Table* t);
 void logT(_Table* t, FILE* log_fp);
+void logOp(Operator* op, FILE* log_fp);
+INT parse_sel(const char* line, Condition* cond, char* table_name);
+INT parse_option(Conf* cf, const char* option);
 
 int main(int argc, char **argv){
     // argv[1] int: page size
     // argv[2] int: buffer size
     // argv[3] int: limit for opened files
-    // argv[4] string: buffer page replacement policy
+    // argv[4] string: buffer page replacement policy, CLS, LRU, LRUK, 2Q or ARC
     // argv[5] string: path for the database
-    // argv[6] string: path for data file
+    // argv[6] string: path for data file, "-" to open the database written
+    //                 by an earlier run instead of loading data
     // argv[7] string: path for test cases
     // argv[8] string: path for output log
-
-    if (argc < 8) {
+    // argv[9...] string: optional settings, key=value
+    //                    smgr=pread|mmap   how table and index files are read
+    //                    ring=N            most buffer slots a large sequential scan
+    //                                      may use, 0 to let it use the whole pool
+    //                    prefetch=N        pages a sequential scan reads ahead in the
+    //                                      background, 0 (default) to read on demand
+    //                    parallel=N        threads scanning a table for a selection,
+    //                                      1 (default) for a sequential scan
+
+    if (argc < 9) {
         printf("Insufficient arguments\n");
         return -1;
     }
 
+    if (repl_parse(argv[4]) == NPOLICY){
+        printf("Unknown buffer replacement policy %s.\n",argv[4]);
+        return -1;
+    }
+
     // load configurations
     UINT page_size,buf_slots,file_limit;
     sscanf(argv[1],"%u",&page_size);
     sscanf(argv[2],"%u",&buf_slots);
     sscanf(argv[3],"%u",&file_limit);
     Conf* cf = init_conf(page_size,buf_slots,file_limit,argv[4]);
+    for (int i = 9; i < argc; i++){
+        if (parse_option(cf,argv[i]) != 0){
+            free_conf();
+            return -1;
+        }
+    }
 
-    printf("Page size: %u, buffer slots: %u, limit of opened files: %u, buffer replacement policy: %s\n",cf->page_size, cf->buf_slots, cf->file_limit, cf->buf_policy);
+    printf("Page size: %u, buffer slots: %u, limit of opened files: %u, buffer replacement policy: %s, storage manager: %s\n",cf->page_size, cf->buf_slots, cf->file_limit, cf->buf_policy, smgr_name(cf->smgr));
 
-    // load data and write database files
-    init_db(argv[6],argv[5]);
+    // load data and write database files, or reopen them from the catalog
+    if (strcmp(argv[6],"-") == 0){
+        open_db(argv[5]);
+    }
+    else{
+        init_db(argv[6],argv[5]);
+    }
     
     
     // implement your initialization function.
@@ -67,46 +98,153 @@ int main(int argc, char **argv){
 
 
 
+// parse an optional setting given as key=value and store it in cf
+// return 0 on success, -1 if the key or the value is unknown
+INT parse_option(Conf* cf, const char* option){
+    const char* value = strchr(option,'=');
+    if (value == NULL){
+        printf("Setting %s is not key=value.\n",option);
+        return -1;
+    }
+    size_t key_len = value - option;
+    value++;
+
+    if (key_len == strlen("smgr") && strncmp(option,"smgr",key_len) == 0){
+        cf->smgr = smgr_parse(value);
+        if (cf->smgr == NSMGR){
+            printf("Unknown storage manager %s.\n",value);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (key_len == strlen("ring") && strncmp(option,"ring",key_len) == 0){
+        char* end;
+        unsigned long n = strtoul(value,&end,10);
+        if (*value == '\0' || *end != '\0' || n > UINT32_MAX){
+            printf("Ring size %s is not a number of slots.\n",value);
+            return -1;
+        }
+        cf->ring_slots = n;
+        return 0;
+    }
+
+    if (key_len == strlen("prefetch") && strncmp(option,"prefetch",key_len) == 0){
+        char* end;
+        unsigned long n = strtoul(value,&end,10);
+        if (*value == '\0' || *end != '\0' || n > MAX_PREFETCH_DEPTH){
+            printf("Prefetch depth %s is not a number of pages up to %d.\n",value,MAX_PREFETCH_DEPTH);
+            return -1;
+        }
+        cf->prefetch_depth = n;
+        return 0;
+    }
+
+    if (key_len == strlen("parallel") && strncmp(option,"parallel",key_len) == 0){
+        char* end;
+        unsigned long n = strtoul(value,&end,10);
+        if (*value == '\0' || *end != '\0' || n < 1 || n > MAX_PARALLEL_WORKERS){
+            printf("Number of threads %s is not between 1 and %d.\n",value,MAX_PARALLEL_WORKERS);
+            return -1;
+        }
+        cf->parallel_workers = n;
+        return 0;
+    }
+
+    printf("Unknown setting %s.\n",option);
+    return -1;
+}
+
+// parse a selection, one or more predicates combined by AND or OR:
+// sel attribute_index compared_value operator [AND|OR ...] table_name
+// operator is one of = == != <> < <= > >=, or BETWEEN whose upper bound
+// comes right after it: attribute_index lower_bound BETWEEN upper_bound
+// return 0 on success, -1 if the line is malformed
+INT parse_sel(const char* line, Condition* cond, char* table_name){
+    char token[50];
+    INT pos = 0;
+    INT n = 0;
+
+    // ra is "sel"
+    sscanf(line,"%19s %n",token,&pos);
+    cond -> conn = CONJ_AND;
+    cond -> npreds = 0;
+
+    while (1){
+        if (cond -> npreds == MAX_PREDS){
+            printf("At most %d predicates in: %s", MAX_PREDS, line);
+            return -1;
+        }
+        Predicate* pred = &cond -> preds[cond -> npreds];
+        pred -> hi = 0;
+        if (sscanf(line + pos,"%u %d %9s %n",&pred -> idx,&pred -> lo,token,&n) != 3){
+            printf("Malformed selection: %s", line);
+            return -1;
+        }
+        pos += n;
+        pred -> op = parse_cmp_op(token);
+        if (pred -> op == UNUSED_CMP){
+            printf("Unknown operator %s in: %s", token, line);
+            return -1;
+        }
+        if (pred -> op == CMP_BETWEEN){
+            if (sscanf(line + pos,"%d %n",&pred -> hi,&n) != 1){
+                printf("BETWEEN needs an upper bound in: %s", line);
+                return -1;
+            }
+            pos += n;
+        }
+        cond -> npreds++;
+
+        // either a connective followed by the next predicate, or table name
+        if (sscanf(line + pos,"%49s %n",token,&n) != 1){
+            printf("Missing table name in: %s", line);
+            return -1;
+        }
+        pos += n;
+        UINT conn = parse_conn(token);
+        if (conn == UNUSED_CMP){
+            strcpy(table_name, token);
+            return 0;
+        }
+        if (cond -> npreds > 1 && conn != cond -> conn){
+            printf("AND and OR can not be mixed in: %s", line);
+            return -1;
+        }
+        cond -> conn = conn;
+    }
+}
+
 // load test cases and test sel and join
 void run(char* ra_path, char* log_path){
 
     
 
     FILE* query_fp = fopen(ra_path,"r");
-    char line[100];
+    char line[256];
 
 
     // replace the old log file if exists
     FILE* log_fp = fopen(log_path,"w");
 
-    while(fgets(line,100,query_fp)){
+    while(fgets(line,sizeof(line),query_fp)){
 
         // lines to write comments
         if(line[0] == '#') continue;
 
         // process selection operator
         if(line[0] == 's'){
-            char ra[20];
-            UINT idx = 0;
-            INT val = 0;
-            char operator[10];
-            char table_name[50];
+            Condition cond;
+            char table_name[50] = "";
 
-            // ra is "sel"
-            // operator is not used for now, i.e., only consider "=="
-            // we assume operator is = for simplicity
-            sscanf(line,"%s %u %d %s %s",ra,&idx,&val,operator,table_name);
+            if (parse_sel(line, &cond, table_name) != 0){
+                continue;
+            }
 
             reset_IO();
 
-            _Table* result = sel(idx,val,table_name);
-            
-
-            // write the result to log file
-            logT(result, log_fp);
-            
-            // release the result table
-            freeT(result);
+            // write the result to log file batch by batch
+            logOp(sel_cond_op(&cond,table_name), log_fp);
             
             continue;
         }
@@ -126,13 +264,28 @@ void run(char* ra_path, char* log_path){
             sscanf(line,"%s %u %s %u %s",ra,&idx1,table1_name,&idx2,table2_name);
 
             reset_IO();
-            // execute join
-            _Table* result = join(idx1,table1_name,idx2,table2_name);
+            // execute join, write the result to log file batch by batch
+            logOp(join_op(idx1,table1_name,idx2,table2_name), log_fp);
+            
+            continue;
+        }
+
+        // build an index: create index attribute_index table_name
+        if(line[0] == 'c'){
+            char ra[20];
+            char object[20];
+            UINT idx = 0;
+            char table_name[50];
 
-            logT(result, log_fp);
+            if (sscanf(line,"%19s %19s %u %49s",ra,object,&idx,table_name) != 4
+                || strcmp(ra,"create") != 0 || strcmp(object,"index") != 0){
+                printf("Malformed create index: %s", line);
+                continue;
+            }
+
+            reset_IO();
+            create_index(idx,table_name);
 
-            freeT(result);
-            
             continue;
         }
 
@@ -166,15 +319,59 @@ void logT(_Table* t, FILE* log_fp){
     
 }
 
+// run an operator and write its result to the log file, tuples are written
+// to a temporary file batch by batch, because the number of tuples and
+// read I/O in the header are only known when the operator finishes
+void logOp(Operator* op, FILE* log_fp){
+    FILE* tuples_fp = tmpfile();
+    if (tuples_fp == NULL){
+        // no temporary file, hold the whole result in memory instead
+        _Table* t = op_materialize(op);
+        logT(t, log_fp);
+        freeT(t);
+        return;
+    }
+
+    Tuple_buf batch = {0, 0, 0, NULL};
+    UINT ntuples = 0;
+
+    op_open(op);
+    UINT nattrs = op->nattrs;
+    while (op_next(op, &batch) > 0){
+        for (UINT64 i = 0; i < batch.ntuples; i++){
+            // write each tuple, separate attributes by space
+            for (UINT j = 0; j < nattrs; j++){
+                fprintf(tuples_fp,"%d ", batch.data[i*nattrs + j]);
+            }
+            // add '\n' to the end of each tuple
+            fprintf(tuples_fp,"\n");
+        }
+        ntuples += batch.ntuples;
+    }
+    op_close(op);
+    free(batch.data);
+
+    // a separator "######"
+    fprintf(log_fp,"\n######\n");
+    // write the number of attributes for each tuple and the number of tuples
+    Conf* cf = get_conf();
+    fprintf(log_fp,"%u %u %u\n\n",nattrs,ntuples,cf->read_io);
+
+    // copy tuples after the header
+    char buf[1 << 16];
+    size_t n;
+    rewind(tuples_fp);
+    while ((n = fread(buf, 1, sizeof(buf), tuples_fp)) > 0){
+        fwrite(buf, 1, n, log_fp);
+    }
+    fclose(tuples_fp);
+}
+
 // free the space of _Table
 void freeT(_Table* t){
     if(t == NULL) return;
 
-    // release memory for each tuple
-    for (UINT i = 0; i < t->ntuples; i++){
-        free(t->tuples[i]);
-    }
-    // release the whole table
+    // tuples are stored in the same allocation, release the whole table
     free(t);
 }
 
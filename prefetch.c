@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "prefetch.h"
+
+// frames reserved for read-ahead, one allocation holds all page images
+static Prefetch_frame* frames = NULL;
+static INT8* frame_slab = NULL;
+static UINT nframes = 0;
+static UINT page_size = 0;
+
+// worker threads reading queued frames
+static pthread_t workers[MAX_PREFETCH_WORKERS];
+static UINT nworkers = 0;
+static bool stopping = false;
+
+// every field of frames is protected by lock, workers wait on queued for
+// requests and readers of a page wait on done for a worker to finish it
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+
+// order of the next request
+static UINT64 next_seq = 0;
+
+// the frame in a state that was requested first, -1 if there is none
+static INT oldest_in_state(UINT state){
+    INT ret = -1;
+    for (UINT i = 0; i < nframes; i++){
+        if (frames[i].state == state && (ret == -1 || frames[i].seq < frames[ret].seq)){
+            ret = i;
+        }
+    }
+    return ret;
+}
+
+// frame holding page pos of table oid, -1 if there is none
+static INT find_frame(UINT oid, UINT64 pos){
+    for (UINT i = 0; i < nframes; i++){
+        if (frames[i].state != PREFETCH_FREE && frames[i].oid == oid && frames[i].pos == pos){
+            return i;
+        }
+    }
+    return -1;
+}
+
+// read queued pages in the order they were requested until shutdown
+static void* worker_main(void* arg){
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    while (true){
+        INT f = oldest_in_state(PREFETCH_QUEUED);
+        if (f == -1){
+            if (stopping){
+                break;
+            }
+            pthread_cond_wait(&queued, &lock);
+            continue;
+        }
+
+        // the frame is only changed by us until it is done, read without lock
+        Prefetch_frame* frame = &frames[f];
+        frame -> state = PREFETCH_READING;
+        pthread_mutex_unlock(&lock);
+        bool ok = smgr_read(&frame -> file, frame -> pos, 1, frame -> data) == 1;
+        pthread_mutex_lock(&lock);
+
+        frame -> ok = ok;
+        frame -> state = PREFETCH_DONE;
+        pthread_cond_broadcast(&done);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+void prefetch_init(UINT depth, UINT size){
+    nframes = depth;
+    page_size = size;
+    stopping = false;
+    next_seq = 0;
+    nworkers = 0;
+    if (nframes == 0){
+        return;
+    }
+
+    frames = malloc(sizeof(Prefetch_frame) * nframes);
+    frame_slab = malloc((size_t)page_size * nframes);
+    for (UINT i = 0; i < nframes; i++){
+        frames[i].state = PREFETCH_FREE;
+        frames[i].seq = 0;
+        frames[i].data = frame_slab + (size_t)page_size * i;
+    }
+
+    // without any worker pages are simply read when they are asked for
+    UINT n = nframes < MAX_PREFETCH_WORKERS ? nframes : MAX_PREFETCH_WORKERS;
+    for (UINT i = 0; i < n; i++){
+        if (pthread_create(&workers[nworkers], NULL, worker_main, NULL) != 0){
+            break;
+        }
+        nworkers++;
+    }
+    if (nworkers == 0){
+        printf("Fail to start prefetch workers, pages are not read ahead.\n");
+        prefetch_shutdown();
+    }
+}
+
+void prefetch_shutdown(){
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    for (UINT i = 0; i < nframes; i++){
+        if (frames[i].state == PREFETCH_QUEUED){
+            frames[i].state = PREFETCH_FREE;
+        }
+    }
+    pthread_cond_broadcast(&queued);
+    pthread_mutex_unlock(&lock);
+
+    for (UINT i = 0; i < nworkers; i++){
+        pthread_join(workers[i], NULL);
+    }
+    nworkers = 0;
+
+    free(frames);
+    free(frame_slab);
+    frames = NULL;
+    frame_slab = NULL;
+    nframes = 0;
+}
+
+UINT prefetch_depth(){
+    return nframes;
+}
+
+void prefetch_start(UINT oid, UINT64 pos, const Smgr_file* f){
+    if (nframes == 0){
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    if (find_frame(oid, pos) == -1){
+        // a free frame, or the page read longest ago that nobody took,
+        // e.g. because its scan stopped early
+        INT i = oldest_in_state(PREFETCH_FREE);
+        if (i == -1){
+            i = oldest_in_state(PREFETCH_DONE);
+        }
+        if (i != -1){
+            frames[i].state = PREFETCH_QUEUED;
+            frames[i].oid = oid;
+            frames[i].pos = pos;
+            frames[i].file = *f;
+            frames[i].ok = false;
+            frames[i].seq = next_seq++;
+            pthread_cond_signal(&queued);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+bool prefetch_take(UINT oid, UINT64 pos, INT8* buf){
+    if (nframes == 0){
+        return false;
+    }
+    pthread_mutex_lock(&lock);
+    bool ok = false;
+    INT i = find_frame(oid, pos);
+    if (i != -1){
+        // a page no worker started on is read by the caller right away
+        // rather than after the pages queued before it
+        while (frames[i].state == PREFETCH_READING){
+            pthread_cond_wait(&done, &lock);
+        }
+        if (frames[i].state == PREFETCH_DONE && frames[i].ok){
+            memcpy(buf, frames[i].data, page_size);
+            ok = true;
+        }
+        frames[i].state = PREFETCH_FREE;
+    }
+    pthread_mutex_unlock(&lock);
+    return ok;
+}
+
+void prefetch_cancel(UINT oid){
+    if (nframes == 0){
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    for (UINT i = 0; i < nframes; i++){
+        if (frames[i].state == PREFETCH_FREE || frames[i].oid != oid){
+            continue;
+        }
+        while (frames[i].state == PREFETCH_READING){
+            pthread_cond_wait(&done, &lock);
+        }
+        frames[i].state = PREFETCH_FREE;
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,56 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+#include <stdbool.h>
+#include "db.h"
+#include "smgr.h"
+
+// state of a prefetch frame
+#define PREFETCH_FREE 0     // holds no page
+#define PREFETCH_QUEUED 1   // waiting for a worker to read its page
+#define PREFETCH_READING 2  // a worker is reading its page
+#define PREFETCH_DONE 3     // the page is read, waiting to be taken
+
+// most worker threads reading pages ahead, a scan rarely keeps more
+// requests in flight than a few threads can serve
+#define MAX_PREFETCH_WORKERS 4
+
+// most frames that may be reserved for read-ahead
+#define MAX_PREFETCH_DEPTH 1024
+
+// a frame reserved for read-ahead, outside of buffer pool, the page is
+// copied into a buffer slot when the scan asks for it
+// this is on purpose rather than reading into reserved buffer slots: a
+// slot would stay pinned with no page while the read is in flight, and
+// depth may exceed the number of slots (run.sh reads 4 pages ahead with 3
+// slots), so read-ahead costs depth pages of memory besides buffer pool
+// and one copy per page taken
+typedef struct Prefetch_frame{
+    UINT state;             // one of PREFETCH_*
+    UINT oid;               // table of the page
+    UINT64 pos;             // position of the page in the table file
+    Smgr_file file;         // the file the page is read from
+    bool ok;                // whether the whole page was read
+    UINT64 seq;             // order the request was issued in
+    INT8* data;             // page image
+}Prefetch_frame;
+
+// reserve depth frames and start the worker threads, 0 turns read-ahead off
+void prefetch_init(UINT depth, UINT page_size);
+// stop the workers and free the frames
+void prefetch_shutdown();
+// number of frames, i.e. how many pages a scan may read ahead
+UINT prefetch_depth();
+
+// start reading page pos of file f of table oid in the background, nothing
+// happens if the page is requested already or every frame is in flight
+void prefetch_start(UINT oid, UINT64 pos, const Smgr_file* f);
+
+// copy page pos of table oid into buf if it was requested, waiting for
+// the read if it is in flight, the frame is free again afterwards
+// return false if the page was not requested or could not be read
+bool prefetch_take(UINT oid, UINT64 pos, INT8* buf);
+
+// forget every page of table oid, the file is about to be closed
+void prefetch_cancel(UINT oid);
+
+#endif
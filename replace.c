@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "replace.h"
+
+// end of a list or a hash chain
+#define NONE -1
+
+// lists a node can be in, what T1, T2, B1 and B2 hold depends on the policy:
+// LRU keeps every page in T1, LRU-K keeps every page in T1 and the history
+// of evicted pages in B1, 2Q uses T1 as A1in, T2 as Am and B1 as A1out,
+// ARC uses all four as in the paper
+#define LIST_FREE 0         // empty buffer slots
+#define LIST_T1 1
+#define LIST_T2 2
+#define LIST_B1 3           // ghosts, pages evicted recently
+#define LIST_B2 4
+#define LIST_SPARE 5        // unused ghost nodes
+#define NLISTS 6
+
+static const char* names[NPOLICY] = {"CLS", "LRU", "LRUK", "2Q", "ARC"};
+
+static UINT policy = POLICY_CLS;
+static UINT nslots = 0;
+static bool (*pinned)(UINT slot) = NULL;
+
+// nslots nodes of buffer slots followed by nslots ghost nodes
+static Repl_node* nodes = NULL;
+static Repl_list lists[NLISTS];
+
+// hash table from (oid, pid) to the ghost remembering it, chained by hnext
+static INT* buckets = NULL;
+static UINT64 nbuckets = 0;
+
+// logical time, increased by each reference, for LRU-K
+static UINT64 now = 0;
+
+// target size of T1 for ARC, between 0 and nslots
+static double arc_p = 0;
+
+UINT repl_parse(const char* name){
+    for (UINT p = 0; p < NPOLICY; p++){
+        if (strcasecmp(name, names[p]) == 0){
+            return p;
+        }
+    }
+    return NPOLICY;
+}
+
+const char* repl_name(UINT p){
+    return p < NPOLICY ? names[p] : "unknown";
+}
+
+static void list_remove(INT n){
+    Repl_list* l = &lists[nodes[n].list];
+    if (nodes[n].prev != NONE) nodes[nodes[n].prev].next = nodes[n].next;
+    else l -> head = nodes[n].next;
+    if (nodes[n].next != NONE) nodes[nodes[n].next].prev = nodes[n].prev;
+    else l -> tail = nodes[n].prev;
+    l -> size--;
+}
+
+static void list_push_head(UINT list, INT n){
+    Repl_list* l = &lists[list];
+    nodes[n].list = list;
+    nodes[n].prev = NONE;
+    nodes[n].next = l -> head;
+    if (l -> head != NONE) nodes[l -> head].prev = n;
+    else l -> tail = n;
+    l -> head = n;
+    l -> size++;
+}
+
+static void list_move_head(UINT list, INT n){
+    list_remove(n);
+    list_push_head(list, n);
+}
+
+// least recently used slot of a list whose page is not pinned, NONE if
+// every page of the list is pinned
+static INT lru_unpinned(UINT list){
+    for (INT n = lists[list].tail; n != NONE; n = nodes[n].prev){
+        if (!pinned(n)){
+            return n;
+        }
+    }
+    return NONE;
+}
+
+static inline UINT64 ghost_bucket(UINT oid, UINT64 pid){
+    UINT64 h = pid * 0x9E3779B97F4A7C15ULL ^ oid;
+    h ^= h >> 29;
+    return h & (nbuckets - 1);
+}
+
+// the ghost remembering page (oid, pid), NONE if it is not remembered
+static INT ghost_find(UINT oid, UINT64 pid){
+    for (INT g = buckets[ghost_bucket(oid, pid)]; g != NONE; g = nodes[g].hnext){
+        if (nodes[g].oid == oid && nodes[g].pid == pid){
+            return g;
+        }
+    }
+    return NONE;
+}
+
+// forget a ghost, its node goes back to the spare ones
+static void ghost_remove(INT g){
+    INT* link = &buckets[ghost_bucket(nodes[g].oid, nodes[g].pid)];
+    while (*link != g){
+        link = &nodes[*link].hnext;
+    }
+    *link = nodes[g].hnext;
+    list_move_head(LIST_SPARE, g);
+}
+
+// forget the oldest ghost of a list
+static void ghost_drop_lru(UINT list){
+    if (lists[list].tail != NONE){
+        ghost_remove(lists[list].tail);
+    }
+}
+
+// remember the page of slot n as the most recent ghost of list, the
+// oldest ghost is forgotten when every ghost node is used
+static void ghost_add(UINT list, INT n){
+    if (lists[LIST_SPARE].size == 0){
+        ghost_drop_lru(lists[list].size > 0 ? list : (list == LIST_B1 ? LIST_B2 : LIST_B1));
+    }
+    INT g = lists[LIST_SPARE].head;
+    list_move_head(list, g);
+    nodes[g].oid = nodes[n].oid;
+    nodes[g].pid = nodes[n].pid;
+    nodes[g].last = nodes[n].last;
+    nodes[g].second_last = nodes[n].second_last;
+
+    UINT64 b = ghost_bucket(nodes[g].oid, nodes[g].pid);
+    nodes[g].hnext = buckets[b];
+    buckets[b] = g;
+}
+
+void repl_init(UINT p, UINT n, bool (*is_pinned)(UINT slot)){
+    policy = p;
+    nslots = n;
+    pinned = is_pinned;
+    now = 0;
+    arc_p = 0;
+
+    for (UINT l = 0; l < NLISTS; l++){
+        lists[l].head = NONE;
+        lists[l].tail = NONE;
+        lists[l].size = 0;
+    }
+
+    // every slot starts empty, every ghost node spare
+    nodes = malloc(sizeof(Repl_node) * nslots * 2);
+    for (UINT i = 0; i < nslots * 2; i++){
+        nodes[i].oid = 0;
+        nodes[i].pid = 0;
+        nodes[i].hnext = NONE;
+        nodes[i].last = 0;
+        nodes[i].second_last = 0;
+        nodes[i].list = i < nslots ? LIST_FREE : LIST_SPARE;
+        nodes[i].prev = NONE;
+        nodes[i].next = NONE;
+        list_push_head(nodes[i].list, i);
+    }
+
+    // the hash table of ghosts is kept at most half full
+    nbuckets = 1;
+    while (nbuckets < (UINT64)nslots * 2){
+        nbuckets <<= 1;
+    }
+    buckets = malloc(sizeof(INT) * nbuckets);
+    for (UINT64 b = 0; b < nbuckets; b++){
+        buckets[b] = NONE;
+    }
+}
+
+void repl_free(){
+    free(nodes);
+    free(buckets);
+    nodes = NULL;
+    buckets = NULL;
+}
+
+void repl_hit(UINT slot){
+    now++;
+    switch (policy){
+        case POLICY_LRU:
+            list_move_head(LIST_T1, slot);
+            break;
+        case POLICY_LRUK:
+            nodes[slot].second_last = nodes[slot].last;
+            nodes[slot].last = now;
+            break;
+        case POLICY_2Q:
+            // a page of A1in is only promoted when it comes back from A1out
+            if (nodes[slot].list == LIST_T2){
+                list_move_head(LIST_T2, slot);
+            }
+            break;
+        case POLICY_ARC:
+            list_move_head(LIST_T2, slot);
+            break;
+    }
+}
+
+void repl_reuse(UINT slot, UINT oid, UINT64 pid){
+    now++;
+    nodes[slot].oid = oid;
+    nodes[slot].pid = pid;
+    nodes[slot].last = now;
+    nodes[slot].second_last = 0;
+
+    // the least recently used end of its list
+    UINT list = nodes[slot].list;
+    list_remove(slot);
+    Repl_list* l = &lists[list];
+    nodes[slot].list = list;
+    nodes[slot].next = NONE;
+    nodes[slot].prev = l -> tail;
+    if (l -> tail != NONE) nodes[l -> tail].next = slot;
+    else l -> head = slot;
+    l -> tail = slot;
+    l -> size++;
+}
+
+// LRU-2 victim, the page whose second last reference is the oldest, pages
+// referenced only once come first, ordered by their last reference
+static INT lruk_victim(){
+    INT victim = NONE;
+    for (INT n = lists[LIST_T1].head; n != NONE; n = nodes[n].next){
+        if (pinned(n)){
+            continue;
+        }
+        if (victim == NONE
+            || nodes[n].second_last < nodes[victim].second_last
+            || (nodes[n].second_last == nodes[victim].second_last && nodes[n].last < nodes[victim].last)){
+            victim = n;
+        }
+    }
+    return victim;
+}
+
+// least recently used unpinned page of list, or of other if every page
+// of list is pinned
+static INT lru_unpinned_of(UINT list, UINT other){
+    INT n = lru_unpinned(list);
+    return n != NONE ? n : lru_unpinned(other);
+}
+
+// REPLACE of ARC with target size p of T1, evict from T1 when it is
+// larger than p
+static INT arc_victim(double p, bool in_b2){
+    UINT t1 = lists[LIST_T1].size;
+    if (t1 >= 1 && ((in_b2 && t1 == (UINT)p) || t1 > p)){
+        return lru_unpinned_of(LIST_T1, LIST_T2);
+    }
+    return lru_unpinned_of(LIST_T2, LIST_T1);
+}
+
+// target size of T1 once page (oid, pid) remembered by a ghost of list
+// ghost_list comes back
+static double arc_adapt(UINT ghost_list){
+    double b1 = lists[LIST_B1].size;
+    double b2 = lists[LIST_B2].size;
+    double p = arc_p;
+    if (ghost_list == LIST_B1){
+        // a page evicted from T1 is wanted again, T1 should be larger
+        p += b2 / b1 > 1 ? b2 / b1 : 1;
+        if (p > nslots) p = nslots;
+    }
+    else if (ghost_list == LIST_B2){
+        // a page evicted from T2 is wanted again, T2 should be larger
+        p -= b1 / b2 > 1 ? b1 / b2 : 1;
+        if (p < 0) p = 0;
+    }
+    return p;
+}
+
+// whether ARC drops the oldest page of T1 unremembered, when T1 fills the
+// whole pool and a page no ghost remembers is read
+static bool arc_t1_full(UINT ghost_list){
+    UINT t1 = lists[LIST_T1].size;
+    return ghost_list == LIST_SPARE && t1 + lists[LIST_B1].size >= nslots && t1 >= nslots;
+}
+
+// A1in of 2Q holds a quarter of the slots, A1out remembers half as many
+// pages as there are slots
+static inline UINT q2_kin(){
+    return nslots / 4 > 0 ? nslots / 4 : 1;
+}
+
+static inline UINT q2_kout(){
+    return nslots / 2 > 0 ? nslots / 2 : 1;
+}
+
+INT repl_victim(UINT oid, UINT64 pid){
+    // an empty slot first, slots given to temporary pages are empty but pinned
+    for (INT n = lists[LIST_FREE].head; n != NONE; n = nodes[n].next){
+        if (!pinned(n)){
+            return n;
+        }
+    }
+
+    switch (policy){
+        case POLICY_LRU:
+            return lru_unpinned(LIST_T1);
+        case POLICY_LRUK:
+            return lruk_victim();
+        case POLICY_2Q:
+            if (lists[LIST_T1].size > q2_kin()){
+                return lru_unpinned_of(LIST_T1, LIST_T2);
+            }
+            return lru_unpinned_of(LIST_T2, LIST_T1);
+        case POLICY_ARC:{
+            INT g = ghost_find(oid, pid);
+            UINT ghost_list = g != NONE ? nodes[g].list : LIST_SPARE;
+            if (arc_t1_full(ghost_list)){
+                return lru_unpinned_of(LIST_T1, LIST_T2);
+            }
+            return arc_victim(arc_adapt(ghost_list), ghost_list == LIST_B2);
+        }
+    }
+    return NONE;
+}
+
+void repl_commit(UINT slot, UINT oid, UINT64 pid){
+    now++;
+    UINT from = nodes[slot].list;
+    UINT list = LIST_T1;
+
+    // forget the ghost of the page first, so making room for new ghosts
+    // never drops it, but keep what the policies need to know about it
+    INT g = ghost_find(oid, pid);
+    UINT ghost_list = g != NONE ? nodes[g].list : LIST_SPARE;
+    UINT64 ghost_last = g != NONE ? nodes[g].last : 0;
+    bool t1_full = policy == POLICY_ARC && arc_t1_full(ghost_list);
+    double p = policy == POLICY_ARC ? arc_adapt(ghost_list) : 0;
+    if (g != NONE){
+        ghost_remove(g);
+    }
+
+    // remember the page evicted from the slot as the policy does
+    switch (policy){
+        case POLICY_LRUK:{
+            // keep the history of the evicted page for when it comes back
+            if (from != LIST_FREE){
+                if (lists[LIST_B1].size == nslots) ghost_drop_lru(LIST_B1);
+                ghost_add(LIST_B1, slot);
+            }
+            break;
+        }
+        case POLICY_2Q:{
+            if (from == LIST_T1){
+                ghost_add(LIST_B1, slot);
+            }
+            while (lists[LIST_B1].size > q2_kout()){
+                ghost_drop_lru(LIST_B1);
+            }
+
+            // a page coming back from A1out is hot, it goes to Am
+            if (ghost_list == LIST_B1){
+                list = LIST_T2;
+            }
+            break;
+        }
+        case POLICY_ARC:{
+            arc_p = p;
+            if (ghost_list != LIST_SPARE){
+                list = LIST_T2;
+            }
+            else if (!t1_full){
+                UINT t1 = lists[LIST_T1].size;
+                UINT total = t1 + lists[LIST_T2].size + lists[LIST_B1].size + lists[LIST_B2].size;
+                if (t1 + lists[LIST_B1].size >= nslots){
+                    ghost_drop_lru(LIST_B1);
+                }
+                else if (total >= 2 * nslots){
+                    ghost_drop_lru(LIST_B2);
+                }
+            }
+
+            // T1 fills the whole pool, its oldest page is dropped unremembered
+            if (from == LIST_T1 && !t1_full){
+                ghost_add(LIST_B1, slot);
+            }
+            else if (from == LIST_T2){
+                ghost_add(LIST_B2, slot);
+            }
+            break;
+        }
+    }
+
+    // the slot now stores page (oid, pid), LRU-K carries on the history
+    // of a page evicted recently
+    list_move_head(list, slot);
+    nodes[slot].oid = oid;
+    nodes[slot].pid = pid;
+    nodes[slot].second_last = ghost_last;
+    nodes[slot].last = now;
+}
+
+void repl_forget(UINT slot){
+    list_move_head(LIST_FREE, slot);
+    nodes[slot].oid = 0;
+    nodes[slot].pid = 0;
+    nodes[slot].last = 0;
+    nodes[slot].second_last = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef REPLACE_H
+#define REPLACE_H
+#include <stdbool.h>
+#include "db.h"
+
+// buffer replacement policies, chosen by Conf.buf_policy
+#define POLICY_CLS 0        // clock sweep, kept in ro.c with the usage count of each slot
+#define POLICY_LRU 1        // least recently used
+#define POLICY_LRUK 2       // LRU-2, largest distance to the second last reference
+#define POLICY_2Q 3         // 2Q, pages referenced once wait in a FIFO queue
+#define POLICY_ARC 4        // adaptive replacement cache
+#define NPOLICY 5
+
+// replacement state of a buffer slot or of a page evicted recently, the
+// nodes of buffer slots come first, node i is buffer slot i
+typedef struct Repl_node{
+    INT prev;               // neighbours in its list, -1 at both ends
+    INT next;
+    UINT list;              // which list the node is in
+    UINT oid;               // page stored in the slot or remembered by the ghost
+    UINT64 pid;
+    INT hnext;              // next ghost in the same bucket of ghost hash table
+    UINT64 last;            // time of the last and the second last
+    UINT64 second_last;     // reference, 0 if there is none, for LRU-K
+}Repl_node;
+
+// a doubly linked list of nodes, head is the most recently used one
+typedef struct Repl_list{
+    INT head;
+    INT tail;
+    UINT size;
+}Repl_list;
+
+// parse a policy name, e.g. "LRUK", ignoring case
+// return POLICY_* of the name, or NPOLICY if there is none
+UINT repl_parse(const char* name);
+const char* repl_name(UINT policy);
+
+// prepare policy for nslots buffer slots, all of them empty, is_pinned
+// tells whether the page of a slot is in use and cannot be evicted
+void repl_init(UINT policy, UINT nslots, bool (*is_pinned)(UINT slot));
+void repl_free();
+
+// a page was found in buffer slot slot
+void repl_hit(UINT slot);
+
+// a page of a sequential scan replaced the page of buffer slot slot
+// without asking the policy, the slot is kept as the next one to evict
+void repl_reuse(UINT slot, UINT oid, UINT64 pid);
+
+// choose the buffer slot page (oid, pid) would be read into, nothing is
+// recorded, the caller may still find the page or lose the slot
+// return the slot, or -1 if every slot is pinned
+INT repl_victim(UINT oid, UINT64 pid);
+
+// page (oid, pid) was read into buffer slot slot, chosen by repl_victim,
+// the page stored there before was evicted by the caller
+void repl_commit(UINT slot, UINT oid, UINT64 pid);
+
+// the page of buffer slot slot was evicted and the slot holds no page of
+// a file any more, it is the first empty slot to be chosen again
+void repl_forget(UINT slot);
+
+#endif
@@ -5,12 +5,49 @@
 #include <string.h>
 #include <stdbool.h>
 #include <math.h>
+#include <unistd.h>
+#include <sched.h>
 
-// store pointers to each page we read from hard drive
-struct Page **buffer_pool = NULL;
+// descriptor of each buffer slot, the page image is stored in buffer_slab
+Page* buffer_pool = NULL;
 
-// next evict 
-UINT nvb = 0;
+// one contiguous allocation holding the page image of every buffer slot
+INT8* buffer_slab = NULL;
+
+// distance in bytes between two buffer slots in buffer_slab,
+// page size rounded up to cache line size
+size_t frame_size;
+
+// next evict, the clock hand only ever moves forward and is advanced
+// atomically, the slot it points to is nvb % nslots
+UINT64 nvb = 0;
+
+// replacement policy of buffer pool, one of POLICY_*
+UINT policy = POLICY_CLS;
+
+// protects the state of replacement policies other than clock sweep,
+// which keep their pages in lists
+pthread_mutex_t repl_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// protects file pointer table and page directories
+pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// signalled when the last read of a file ends, so the file may be closed
+pthread_cond_t file_idle = PTHREAD_COND_INITIALIZER;
+
+// pages pinned by the calling thread, if they are all of buffer pool
+// no other thread can ever unpin a slot for it
+static __thread UINT thread_pins = 0;
+
+// pins reserved by operators holding several pages at once, never more
+// than nslots, protected by pin_lock and signalled when some are given back
+static UINT reserved_pins = 0;
+pthread_mutex_t pin_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pins_unreserved = PTHREAD_COND_INITIALIZER;
+
+// requests of a page found in buffer pool and requests that read it
+UINT64 nhits = 0;
+UINT64 nmisses = 0;
 
 // record the opened file, in which we use -1 to represent unused table slot
 // and any positive number to represent an opened table(oid)
@@ -22,6 +59,20 @@ UINT page_size;
 // number of slots in buffer pool
 UINT nslots;
 
+// buffer mapping table, a hash table from (oid, pid) to buffer slot, so
+// finding a page does not scan every slot, entry i belongs to slot i
+Buf_tag* buf_table = NULL;
+
+// first entry of each bucket of buffer mapping table, UNUSED if empty
+INT* buf_buckets = NULL;
+
+// number of buckets, a power of 2
+UINT64 buf_nbuckets;
+
+// bucket b of buffer mapping table is guarded by lock b % NUM_BUF_PARTITIONS,
+// held shared to look a page up and pin it, exclusive to add or remove one
+pthread_rwlock_t buf_partition_locks[NUM_BUF_PARTITIONS];
+
 // maximum number of files we can open
 UINT file_limit;
 
@@ -29,72 +80,81 @@ UINT file_limit;
 // one file to open an new file
 UINT next_delete = 0;
 
-// maximum number of tuples per page
-INT max_ntuples_per_page;
-
-// maximum attribute of the table with smallest tuple
-UINT nattrs_max;
-
-// release the page from buffer pool
-static void clean_buffer(UINT i,INT flag){
-   buffer_pool[i] -> oid = 0;
-   buffer_pool[i] -> usage = 0;
-   buffer_pool[i] -> pin_count = 0;
-   buffer_pool[i] -> nattrs = 0;
-   buffer_pool[i] -> ntuples_per_page = 0;
-   buffer_pool[i] -> ntuples = 0;
-   buffer_pool[i] -> pid = 0;
-
-    // free each pointer in pointer arrays and make them point to NULL
-    for (INT ntup = 0; ntup < max_ntuples_per_page; ntup++){
-        // we are initializing buffer if flag == 0
-        // we can't free pointer to tuple when we are initailizing them at the first time
-        // because this pointer may points to somewhere which is not in heap memory
-        if (flag == 0){
-            buffer_pool[i] -> tuples[ntup] = NULL;
-        }
-        else if (flag == 1){
-            // reset all value to 0
-            for (UINT na = 0; na < nattrs_max; na++){
-                buffer_pool[i] -> tuples[ntup][na] = 0;
-            }
-        }
-        else if (flag == 2){
-            // release all resources when all queries finished
-            // free all tuples stored in page
-            free(buffer_pool[i] -> tuples[ntup]);            
-        }
-    }
+// page directory of each table we have opened, directories stay where
+// they are when more are added
+Page_dir** page_dirs = NULL;
 
-    // free page
-    if (flag == 2){
-        free(buffer_pool[i]);
-    }
+// number of page directories built
+UINT npage_dirs = 0;
+
+// get the i-th tuple of the page stored in a buffer slot, tuples are
+// addressed by their offset after the page id in the page image
+static inline Tuple page_tuple(UINT page_index, UINT i){
+    return (Tuple)(buffer_pool[page_index].data + sizeof(UINT64)) + (size_t)i * buffer_pool[page_index].nattrs;
+}
+
+// release the page from buffer pool, the page image is simply
+// overwritten by the next page we read into this slot
+static void clean_buffer(UINT i){
+   buffer_pool[i].flag = UNUSED;
+   buffer_pool[i].oid = 0;
+   buffer_pool[i].usage = 0;
+   buffer_pool[i].pin_count = 0;
+   buffer_pool[i].nattrs = 0;
+   buffer_pool[i].ntuples_per_page = 0;
+   buffer_pool[i].ntuples = 0;
+   buffer_pool[i].pid = 0;
+}
+
+// hash (oid, pid) of a page to find its entry in buffer mapping table
+static inline UINT64 hash_buf_tag(UINT64 pid, UINT oid){
+    UINT64 h = pid * 0x9E3779B97F4A7C15ULL ^ ((UINT64)oid << 32 | oid);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// bucket of buffer mapping table a page belongs to
+static inline UINT64 buf_bucket(UINT64 pid, UINT oid){
+    return hash_buf_tag(pid, oid) & (buf_nbuckets - 1);
+}
+
+static inline pthread_rwlock_t* buf_partition_lock(UINT64 bucket){
+    return &buf_partition_locks[bucket % NUM_BUF_PARTITIONS];
 }
 
-// check whether a file is opened in file pointer table
-static bool is_file_open(UINT oid){
-    for(int i = 0; i < file_limit; i++){
-        if (file_table[i].oid == oid
-            && file_table[i].flag != UNUSED){
-            return true;
+// find the buffer slot storing the page we want, UNUSED if it is not in buffer pool
+// the lock of the partition of bucket is held
+static INT buf_table_lookup(UINT64 bucket, UINT64 pid, UINT oid){
+    for (INT i = buf_buckets[bucket]; i != UNUSED; i = buf_table[i].next){
+        if (buf_table[i].pid == pid && buf_table[i].oid == oid){
+            return i;
         }
     }
-    return false;
+    return UNUSED;
 }
 
-// check whether the page we want is stored in buffer pool
-static bool in_buffer_pool(UINT64 page_number,UINT oid){
-    // traverse all slots to check whether the page is in buffer pool
-    for (UINT i = 0; i < nslots; i++){
-        if (buffer_pool[i] -> pid == page_number 
-            &&  buffer_pool[i] -> oid == oid)
-        {
+// record the buffer slot of a page we are about to read into buffer pool,
+// the lock of the partition of bucket is held exclusively
+static void buf_table_insert(UINT64 bucket, UINT64 pid, UINT oid, UINT slot){
+    buf_table[slot].pid = pid;
+    buf_table[slot].oid = oid;
+    buf_table[slot].next = buf_buckets[bucket];
+    buf_buckets[bucket] = slot;
+}
 
-            return true;
-        }
+// remove the entry of a page evicted from buffer pool,
+// the lock of the partition of bucket is held exclusively
+static void buf_table_delete(UINT64 bucket, UINT slot){
+    INT* link = &buf_buckets[bucket];
+    while (*link != UNUSED && *link != (INT)slot){
+        link = &buf_table[*link].next;
     }
-    return false;
+    if (*link == (INT)slot){
+        *link = buf_table[slot].next;
+    }
+    buf_table[slot].next = UNUSED;
 }
 
 // check whether file pointer table is full
@@ -112,979 +172,3070 @@ static INT64 is_full(){
 
 // open an new file and store in file pointer table
 // if table is full, close one of the file
-static void open_file(UINT oid){
-    // get data file path
-    char path[] = "./data/";
-
-    // the longest length for oid in char is 11 bytes, 2^32 = 4294967296
-    char data_file[11] = "";
-    sprintf(data_file,"%d",oid);
-    strcat(path,data_file);
+// file_lock is held, return the entry of the file in file pointer table
+static UINT open_file(UINT oid){
+    // get data file path, in the database folder or the tablespace of the table
+    char path[PATH_MAX];
+    file_path(oid, path, sizeof(path));
 
     // open the corresponding data file and start reading pages
-    FILE* query_file = fopen(path,"r");
+    Smgr_file query_file;
+    if (!smgr_open(&query_file, path)){
+        perror("Fail to open the data file.\n");
+        exit(-1);
+    }
 
     INT64 file_index = is_full();
     // if file pointer table is not full
     if (file_index != -1){
         file_table[file_index].flag = 1;
         file_table[file_index].oid = oid;
-        file_table[file_index].file_opened = query_file;
-        log_open_file(oid);
-    }
-    // file pointer table is full, delete one of the file and open an new file
-    else{
-        // close previous file
-        INT64 old_file_oid = file_table[next_delete%file_limit].oid;
-        fclose(file_table[next_delete%file_limit].file_opened);
-        log_close_file(old_file_oid);
-        
-        // open new file
-        file_table[next_delete%file_limit].oid = oid;
-        file_table[next_delete%file_limit].file_opened = query_file;
+        file_table[file_index].file = query_file;
+        file_table[file_index].nreaders = 0;
         log_open_file(oid);
-        next_delete++;
+        return file_index;
     }
-}
 
-// get a free buffer using clock-sweep
-static UINT get_free_buffer_slot(){
-    // all slots are used, try to find an possible victim buffer
+    // file pointer table is full, delete one of the file and open an new
+    // file, a file pages are being read from is skipped, and if every file
+    // is being read we wait until one of them is not
     while (true){
-        if (buffer_pool[nvb] -> usage == 0 && buffer_pool[nvb] -> pin_count == 0){    
-            // free the page in buffer pool, will be assigned for the page of new file later
-            clean_buffer(nvb,1);
-
-            if (buffer_pool[nvb] -> ntuples != 0){
-                log_release_page(buffer_pool[nvb]->pid);
-            }
-
-            UINT ret = nvb;
-            nvb = (nvb + 1) % nslots;
-            return ret;
+        UINT k = 0;
+        while (k < file_limit && file_table[(next_delete + k) % file_limit].nreaders > 0){
+            k++;
         }
-        else{
-            if ( buffer_pool[nvb] -> usage != 0){
-                buffer_pool[nvb] -> usage--;
-            }
-            
-            nvb = (nvb + 1) % nslots;
+        if (k < file_limit){
+            next_delete += k;
+            break;
         }
-    }   
-}
+        pthread_cond_wait(&file_idle, &file_lock);
+    }
+    file_index = next_delete % file_limit;
 
-// read page into buffer pool
-static void read_into_buffer_pool(UINT free_buffer_slot_index,
-                                  UINT64 pid,
-                                  UINT oid,
-                                  UINT ntuples_per_page,
-                                  UINT nattrs,
-                                  FILE* query_file,
-                                  UINT64 npages){
-    // start reading page into buffer pool
-    log_read_page(pid);
-
-    // update page meta data in buffer pool
-    buffer_pool[free_buffer_slot_index] -> oid = oid;
-    buffer_pool[free_buffer_slot_index] -> pid = pid;
-    buffer_pool[free_buffer_slot_index] -> ntuples_per_page = ntuples_per_page;
-    buffer_pool[free_buffer_slot_index] -> nattrs = nattrs;
+    // close previous file
+    INT64 old_file_oid = file_table[file_index].oid;
+    prefetch_cancel(old_file_oid);
+    smgr_close(&file_table[file_index].file);
+    log_close_file(old_file_oid);
     
-    // find the page we want to read
-    UINT64 current_pageId;
-   
-    UINT64 result_pos = 0;
+    // open new file
+    file_table[file_index].oid = oid;
+    file_table[file_index].file = query_file;
+    file_table[file_index].nreaders = 0;
+    log_open_file(oid);
+    next_delete++;
+    return file_index;
+}
 
-    for (UINT64 pos = 0; pos < npages; pos++){
-         // move to start of each page
-        fseek(query_file,page_size*pos,SEEK_SET);
-        fread(&current_pageId,sizeof(UINT64),1,query_file);
-       
-        // find the page id we want
-        if (current_pageId == pid){
-            result_pos = pos;
+// entry of file pointer table holding the file of a table, the file is
+// opened if it is not, file_lock is held
+static UINT get_file_entry(UINT oid){
+    for (UINT i = 0; i < file_limit; i++){
+        if (file_table[i].flag != UNUSED && file_table[i].oid == oid){
+            return i;
         }
     }
-    // read one page
-    // move to the current page from the beginning of file
-    fseek(query_file, page_size*result_pos, SEEK_SET);
-
-    // skip page id
-    fseek(query_file, sizeof(UINT64), SEEK_CUR);
-
-    // read each tuple in the page
-    // record index of each tuple to store in buffer
-    UINT tuple_index = 0;
-
-    for (UINT tuple = 0; tuple < ntuples_per_page; tuple++){        
-        // each time we scan one attribute in a tuple
-        INT each_tuple[nattrs];
+    return open_file(oid);
+}
 
-        fread(each_tuple,sizeof(INT),nattrs,query_file);
+// whether the page of a buffer slot is in use, for replacement policies
+static bool is_pinned(UINT slot){
+    return __atomic_load_n(&buffer_pool[slot].pin_count, __ATOMIC_ACQUIRE) != 0;
+}
 
-        // check whether we reach the end of each page
-        bool reach_end = true;
-        for (UINT attr = 0; attr < nattrs; attr++){
-            if (each_tuple[attr] != 0){
-                reach_end = false;
-            }
-        }
+// pin a slot nobody pins, so that no other thread chooses it to evict
+// return false if it is pinned
+static bool try_claim(UINT slot){
+    UINT unpinned = 0;
+    if (!__atomic_compare_exchange_n(&buffer_pool[slot].pin_count, &unpinned, 1,
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+        return false;
+    }
+    thread_pins++;
+    return true;
+}
 
-        // end of page
-        if (reach_end){
-            break;
+// no slot could be claimed, let other threads unpin one, a thread holding
+// as many pins as there are slots while every slot is pinned would wait
+// for itself forever
+static void wait_for_unpin(){
+    if (thread_pins >= nslots){
+        UINT i = 0;
+        while (i < nslots && is_pinned(i)){
+            i++;
         }
-
-        // not the end of page, store this tuple into buffer
-        for (UINT at = 0; at < nattrs; at++){
-            buffer_pool[free_buffer_slot_index] -> tuples[tuple_index][at] = each_tuple[at];    
+        if (i == nslots){
+            printf("All %u buffer slots are pinned.\n", nslots);
+            exit(-1);
         }
-        tuple_index++;
     }
+    sched_yield();
+}
 
-    // record total number of tuples we store
-    buffer_pool[free_buffer_slot_index] -> ntuples = tuple_index;
-    
-    // set the rest of pointers to points to array of 0
-    while (tuple_index != max_ntuples_per_page){
-        for (UINT i = 0; i < nattrs; i++){
-            buffer_pool[free_buffer_slot_index] -> tuples[tuple_index][i] = 0;
-        }
+// an operator pinning up to n pages at once reserves them first, with no
+// pin held, and waits while the reservations of other operators leave too
+// few slots, a thread without a reservation pins one page at a time, so
+// threads waiting for a slot hold fewer pins than they reserved and some
+// slot is always pinned by a thread that will unpin it, or by none
+static void reserve_pins(UINT n){
+    if (n > nslots){
+        n = nslots;
+    }
+    pthread_mutex_lock(&pin_lock);
+    while (reserved_pins + n > nslots){
+        pthread_cond_wait(&pins_unreserved, &pin_lock);
+    }
+    reserved_pins += n;
+    pthread_mutex_unlock(&pin_lock);
+}
 
-        tuple_index++;
+// give back n pins reserved by reserve_pins, once they are all unpinned
+static void unreserve_pins(UINT n){
+    if (n > nslots){
+        n = nslots;
     }
+    pthread_mutex_lock(&pin_lock);
+    reserved_pins -= n;
+    pthread_cond_broadcast(&pins_unreserved);
+    pthread_mutex_unlock(&pin_lock);
 }
 
-// get the index of page stored in buffer
-static UINT get_page_index(UINT64 pid,UINT oid){
-    UINT ret_index = 0;
-    for (UINT i = 0; i < nslots; i++){
-        if (buffer_pool[i] -> oid == oid
-         && buffer_pool[i] -> pid == pid){
-            ret_index = i;
-         }
+// get a free buffer for page (oid, pid) using clock-sweep, or the policy
+// chosen by buf_policy, the slot returned is pinned by the caller and its
+// page is evicted by the caller, who tells the policy with install_page
+// once the slot is surely given to the page
+// when every slot is pinned we wait for other threads to unpin one, with
+// any policy, unless we pinned all of them ourselves
+static UINT get_free_buffer_slot(UINT64 pid, UINT oid){
+    if (policy != POLICY_CLS){
+        // pages are only pinned with repl_lock held, so the slot the
+        // policy chooses stays unpinned until we claim it
+        while (true){
+            pthread_mutex_lock(&repl_lock);
+            INT slot = repl_victim(oid, pid);
+            bool claimed = slot != UNUSED && try_claim(slot);
+            pthread_mutex_unlock(&repl_lock);
+            if (claimed){
+                return slot;
+            }
+            wait_for_unpin();
+        }
     }
-    return ret_index;
+
+    // all slots are used, try to find an possible victim buffer, the clock
+    // hand is moved without any lock and a usage count is only decreased
+    // if nobody changed it meanwhile, after each round of the pool without
+    // a victim other threads get the chance to unpin a slot
+    for (UINT64 nswept = 1; ; nswept++){
+        if (nswept % nslots == 0){
+            wait_for_unpin();
+        }
+        UINT slot = __atomic_fetch_add(&nvb, 1, __ATOMIC_RELAXED) % nslots;
+        UINT usage = __atomic_load_n(&buffer_pool[slot].usage, __ATOMIC_RELAXED);
+        if (usage == 0){
+            if (try_claim(slot)){
+                return slot;
+            }
+        }
+        else{
+            __atomic_compare_exchange_n(&buffer_pool[slot].usage, &usage, usage - 1,
+                                        false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+    }   
 }
 
 // get the corresponding file descriptor to read page
-static FILE* get_file_descriptor_from_table(UINT oid){
-    FILE *ret_file = NULL;
+static const Smgr_file* get_file_descriptor_from_table(UINT oid){
+    const Smgr_file* ret_file = NULL;
     
     for (UINT i = 0; i < file_limit; i++){
         if (file_table[i].flag != UNUSED 
             && file_table[i].oid == oid) 
         {
-            ret_file = file_table[i].file_opened;
+            ret_file = &file_table[i].file;
         };
     }
 
     return ret_file;
 };
 
-// find an available index in the slot of hash table to insert an new tuple
-static UINT find_next_free_tuple(Tuple** hash_table,UINT hash_index,UINT ntuples_per_page,UINT nattrs){
-    // starting from the end of slot, find the first free tuple
-    UINT ret = ntuples_per_page - 1;
-    
-    // check each tuple
-    while (ret != -1){
-        bool is_free = true;
-        for (UINT at = 0; at < nattrs; at++){
-            if (hash_table[hash_index][ret][at] != 0){
-                is_free = false;
-                break;
-            }
-        }
-        
-        // find an free slot to insert tuple
-        if (is_free){
-            break;
-        }
+// order entries of page directory by page id
+static int cmp_page_pos(const void* a, const void* b){
+    UINT64 pid_a = ((const Page_pos*)a) -> pid;
+    UINT64 pid_b = ((const Page_pos*)b) -> pid;
+    return (pid_a > pid_b) - (pid_a < pid_b);
+}
 
-        // go to check next slot
-        ret--;
+// find the page directory of a table, return NULL if it is not built yet
+static Page_dir* find_page_dir(UINT oid){
+    for (UINT i = 0; i < npage_dirs; i++){
+        if (page_dirs[i] -> oid == oid){
+            return page_dirs[i];
+        }
     }
-    
-    // if slot is full, return -1, else return index of an available tuple
-    return ret;
+    return NULL;
 }
 
-// insert tuple into hash table
-static void insert_tuple_into_slot(Tuple** hash_table,UINT hash_index,UINT slot_index,UINT page_index,UINT np){
-    UINT nattrs = buffer_pool[page_index] -> nattrs;
-
-    // assign each attribute
-    for (UINT at = 0; at < nattrs; at++){
-        hash_table[hash_index][slot_index][at] = buffer_pool[page_index] -> tuples[np][at];
+// get the page directory of a table, built when the table is requested
+// for the first time from the page ids the catalog keeps for it, so no
+// page is read, the page id of a node of an index is its page number
+// file_lock is held
+static Page_dir* get_page_dir(UINT oid, UINT64 npages){
+    Page_dir* dir = find_page_dir(oid);
+    if (dir != NULL){
+        return dir;
     }
-}
 
-// clear one of the slot in hash table when it is full
-static void clear_slot(Tuple** hash_table,UINT hash_index,UINT ntuples_per_page,UINT nattrs){
-    // reset each attribute of each tuple to 0
-    for (UINT np = 0; np < ntuples_per_page; np++){
-        for (UINT at = 0; at < nattrs; at++){
-            hash_table[hash_index][np][at] = 0;
+    const UINT64* table_pids = NULL;
+    UINT64 ntuples = 0;
+    Database* db = get_db();
+    for (UINT i = 0; i < db -> ntables; i++){
+        if (db -> tables[i].oid == oid){
+            table_pids = db -> tables[i].pids;
+            npages = db -> tables[i].npages;
+            ntuples = db -> tables[i].ntuples;
         }
     }
-}
 
-static UINT get_requested_page(UINT64 pid,UINT oid,INT ntuples_per_page,UINT nattrs,UINT64 npages){
-    UINT page_index = 0;
+    dir = malloc(sizeof(Page_dir));
+    page_dirs = realloc(page_dirs, sizeof(Page_dir*) * (npage_dirs + 1));
+    page_dirs[npage_dirs] = dir;
+    npage_dirs++;
 
-    // the page we query is not in buffer pool
-    if (!in_buffer_pool(pid,oid)){
-                    
-        // implement clock-sweep replacement to get next free buffer
-        page_index = get_free_buffer_slot();
+    dir -> oid = oid;
+    dir -> npages = npages;
+    dir -> ntuples = ntuples;
+    dir -> pids = malloc(sizeof(UINT64) * (npages > 0 ? npages : 1));
+    dir -> sorted = malloc(sizeof(Page_pos) * (npages > 0 ? npages : 1));
+    for (UINT64 pos = 0; pos < npages; pos++){
+        UINT64 pid = table_pids != NULL ? table_pids[pos] : pos;
+        dir -> pids[pos] = pid;
+        dir -> sorted[pos].pid = pid;
+        dir -> sorted[pos].pos = pos;
+    }
 
-        FILE *query_file = get_file_descriptor_from_table(oid);
+    qsort(dir -> sorted, dir -> npages, sizeof(Page_pos), cmp_page_pos);
 
-        // read page from hard drive and store into buffer pool
-        read_into_buffer_pool(page_index,
-                                pid,
-                                oid,
-                                ntuples_per_page,
-                                nattrs,
-                                query_file,
-                                npages);
+    return dir;
+}
 
-    }
+// get the position of a page in its file, -1 if the page does not exist
+static INT64 get_page_pos(const Page_dir* dir, UINT64 pid){
+    UINT64 low = 0;
+    UINT64 high = dir -> npages;
 
-    // the page we query is in buffer pool
-    else{
-        page_index = get_page_index(pid,oid);
+    // binary search over entries sorted by page id
+    while (low < high){
+        UINT64 mid = low + (high - low) / 2;
+        if (dir -> sorted[mid].pid < pid){
+            low = mid + 1;
+        }
+        else{
+            high = mid;
+        }
     }
 
-    // increase pin count for current transcation
-    buffer_pool[page_index] -> pin_count++;
-    
-    // increase the popularity of page
-    buffer_pool[page_index] -> usage++;
-
-    return page_index;
+    if (low < dir -> npages && dir -> sorted[low].pid == pid){
+        return dir -> sorted[low].pos;
+    }
+    return -1;
 }
 
-static Table_meta get_table_meta(const char* table1_name) {
-    struct Table_meta table;
-     
-    Database* db = get_db();
-    UINT ntables = db -> ntables;
-    
-    // get meta data of table 1 
-    for (UINT i = 0; i < ntables; i++){
-        char *each_table = db -> tables[i].name;
-        if (strcmp(each_table,table1_name) == 0){
-            table.oid = db -> tables[i].oid;
-            table.nattrs = db -> tables[i].nattrs;
-            table.ntuples = db -> tables[i].ntuples;
-        }
+// number of tuples in page pos of a file, every page of a table but the
+// last one is full and the catalog tells how many tuples the table has,
+// so the last page is never guessed from its content
+static UINT get_page_ntuples(const Page_dir* dir, UINT64 pos, UINT ntuples_per_page){
+    if (pos + 1 < dir -> npages){
+        return ntuples_per_page;
     }
+    return dir -> ntuples - (dir -> npages - 1) * ntuples_per_page;
+}
 
-    // get number of pages for the table we open
-    table.ntuples_per_page = (page_size-sizeof(UINT64))/sizeof(INT)/table.nattrs;
-    // table.npages = ceil(table.ntuples/table.ntuples_per_page);
-    UINT ntuples = table.ntuples; 
-    INT ntuples_per_page = table.ntuples_per_page;
-    table.npages = 0;
-    while (ntuples > ntuples_per_page){
-        table.npages++;
-        ntuples -= ntuples_per_page;
+// read page result_pos of a file holding ntuples tuples into buffer pool,
+// the page meta data is set already and the content latch of the slot is
+// held, no other lock is, so pages of different slots are read at the same time
+static void read_into_buffer_pool(UINT free_buffer_slot_index,
+                                  UINT oid,
+                                  INT64 result_pos,
+                                  UINT ntuples,
+                                  const Smgr_file* query_file){
+    // a mapped file is used in place, otherwise the whole page image is
+    // copied from the frame it was read ahead into, or read into buffer
+    // slot with one positioned read
+    INT8* data = smgr_map_page(query_file, result_pos);
+    if (data == NULL){
+        data = buffer_slab + frame_size * free_buffer_slot_index;
+        if (!prefetch_take(oid, result_pos, data) && smgr_read(query_file, result_pos, 1, data) != 1){
+            memset(data, 0, page_size);
+        }
     }
+    buffer_pool[free_buffer_slot_index].data = data;
 
-    table.npages++;
-
-    return table;
+    // record total number of tuples we store
+    buffer_pool[free_buffer_slot_index].ntuples = ntuples;
 }
 
-// return all page id we read all the corresponding file
-static void get_page_ids(UINT oid, UINT64 npages, UINT64 pageId_array[]){    
-    
-    // if the file is not opened, open(stored) in file pointer table
-    if(!is_file_open(oid)){
-        open_file(oid);
-    };
+// make room for n more tuples in result buffer
+static void reserve_tuples(Tuple_buf* buf, UINT64 n){
+    if (buf -> ntuples + n <= buf -> capacity){
+        return;
+    }
+    UINT64 capacity = buf -> capacity == 0 ? 64 : buf -> capacity * 2;
+    while (capacity < buf -> ntuples + n){
+        capacity *= 2;
+    }
+    INT* data = realloc(buf -> data, sizeof(INT) * buf -> nattrs * capacity);
+    if (data == NULL){
+        printf("Fail to allocate %lu result tuples.\n", capacity);
+        exit(-1);
+    }
+    buf -> data = data;
+    buf -> capacity = capacity;
+}
 
-    FILE *query_file = get_file_descriptor_from_table(oid);
+// append n tuples stored one after another to result buffer
+static void append_tuples(Tuple_buf* buf, const INT* tuples, UINT64 n){
+    reserve_tuples(buf, n);
+    memcpy(buf -> data + buf -> ntuples * buf -> nattrs, tuples, sizeof(INT) * buf -> nattrs * n);
+    buf -> ntuples += n;
+}
 
-    UINT64 current_index = 0;
-    UINT64 current_pageId = 0;
+// append a joined tuple to result buffer, flag tells which table goes first
+static void append_joined(Tuple_buf* buf, const INT* t1, UINT nattrs_1, const INT* t2, UINT nattrs_2, INT flag){
+    reserve_tuples(buf, 1);
+    INT* t = buf -> data + buf -> ntuples * buf -> nattrs;
 
-    // read all page id store it into return array
-    for (UINT64 i = 0; i < npages; i++){
-        fseek(query_file,page_size*i,SEEK_SET);
-        fread(&current_pageId,sizeof(UINT64),1,query_file);
-        pageId_array[current_index] = current_pageId;
-        current_index++;
+    // store the attribute of table 1 first
+    if (flag == 0){
+        memcpy(t, t1, sizeof(INT) * nattrs_1);
+        memcpy(t + nattrs_1, t2, sizeof(INT) * nattrs_2);
+    }
+    // store the attribute of table 2 first
+    else{
+        memcpy(t, t2, sizeof(INT) * nattrs_2);
+        memcpy(t + nattrs_2, t1, sizeof(INT) * nattrs_1);
     }
+    buf -> ntuples++;
 }
 
-// initialize buffer pool and file pointer table
-void init(){
-    // config all meta data
-    Conf* cf = get_conf();
-
-    // initialize page size
-    page_size = cf -> page_size;
+// create return table from result buffer and release the buffer
+// all tuples are copied into the contiguous block of the _Table at once
+static _Table* tuple_buf_to_table(Tuple_buf* buf){
+    _Table* ret_table = new_table(buf -> nattrs, buf -> ntuples);
+    if (buf -> ntuples != 0){
+        memcpy(table_data(ret_table), buf -> data, sizeof(INT) * buf -> nattrs * buf -> ntuples);
+    }
+    free(buf -> data);
+    buf -> data = NULL;
+    return ret_table;
+}
 
-    // first calculate the maximum number of tuples per page, then use it to initialize buffer pool
-    Database *db = get_db();
-    
-    // find minimal number of attributes pei page in each table
-    // maximum number of attributes is 2^32 - 1, which is 4,294,967,295
-    UINT nattrs_min = 4294967295;
+// hash a join key, murmur3 finalizer so that close keys are spread well
+static inline UINT hash_key(INT key){
+    UINT h = (UINT)key;
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35;
+    h ^= h >> 16;
+    return h;
+}
 
-    nattrs_max = 0;
+static inline bool ht_is_occupied(const Hash_table* ht, UINT64 slot){
+    return (ht -> occupied[slot >> 6] >> (slot & 63)) & 1;
+}
 
-    for (UINT i = 0; i < db->ntables; i++){
-        if (db->tables[i].nattrs < nattrs_min){
-            nattrs_min = db->tables[i].nattrs;
-        }
-        if (db->tables[i].nattrs > nattrs_max){
-            nattrs_max = db->tables[i].nattrs;
-        }
+// allocate slots of hash table, all of them empty
+static void ht_alloc_slots(Hash_table* ht, UINT64 nslots_ht){
+    ht -> nslots = nslots_ht;
+    ht -> nkeys = 0;
+    ht -> keys = malloc(sizeof(INT) * nslots_ht);
+    ht -> first = malloc(sizeof(INT64) * nslots_ht);
+    ht -> occupied = calloc((nslots_ht + 63) / 64, sizeof(UINT64));
+    if (ht -> keys == NULL || ht -> first == NULL || ht -> occupied == NULL){
+        printf("Fail to allocate %lu slots of hash table.\n", nslots_ht);
+        exit(-1);
     }
+}
 
-    // maximum number of tuples per page
-    max_ntuples_per_page = (page_size-sizeof(UINT64))/sizeof(INT)/nattrs_min;
+// create a hash table for rows of nattrs attributes keyed by attribute idx,
+// expected_rows and expected_keys are only hints, the table grows when it
+// is needed
+static void ht_init(Hash_table* ht, UINT nattrs, UINT idx, UINT64 expected_rows, UINT64 expected_keys){
+    ht -> nattrs = nattrs;
+    ht -> idx = idx;
+    ht -> nrows = 0;
+    ht -> row_capacity = expected_rows > 0 ? expected_rows : 64;
+    ht -> rows = malloc(sizeof(INT) * nattrs * ht -> row_capacity);
+    ht -> next = malloc(sizeof(INT64) * ht -> row_capacity);
+    if (ht -> rows == NULL || ht -> next == NULL){
+        printf("Fail to allocate %lu rows of hash table.\n", ht -> row_capacity);
+        exit(-1);
+    }
 
-    // get number of buffer to initialize buffer_pool
-    nslots = cf -> buf_slots;
-    
-    // initialize each pointer to page
-    buffer_pool= malloc(sizeof(Page*) * nslots);
+    // slots only hold distinct keys, keep their load factor below 1/2
+    if (expected_keys == 0 || expected_keys > ht -> row_capacity){
+        expected_keys = ht -> row_capacity;
+    }
+    UINT64 nslots_ht = 64;
+    while (nslots_ht < expected_keys * 2){
+        nslots_ht <<= 1;
+    }
+    ht_alloc_slots(ht, nslots_ht);
+}
 
-    // malloc space for each pointer to page
-    for (UINT i = 0; i < nslots; i++){
-        buffer_pool[i] = malloc(sizeof(Page) + (max_ntuples_per_page*sizeof(Tuple)));
+// find the slot of a key by linear probing, or the empty slot where it should be
+static inline UINT64 ht_find_slot(const Hash_table* ht, INT key){
+    UINT64 mask = ht -> nslots - 1;
+    UINT64 slot = hash_key(key) & mask;
+    while (ht_is_occupied(ht, slot) && ht -> keys[slot] != key){
+        slot = (slot + 1) & mask;
     }
+    return slot;
+}
 
-    // reset all member to page to default
-    for (UINT i = 0; i < nslots; i++){
-        clean_buffer(i,0); 
+// double the number of slots and move each key to its new slot,
+// the chains of rows stay as they are
+static void ht_grow(Hash_table* ht){
+    UINT64 old_nslots = ht -> nslots;
+    INT* old_keys = ht -> keys;
+    INT64* old_first = ht -> first;
+    UINT64* old_occupied = ht -> occupied;
+    UINT64 nkeys = ht -> nkeys;
+
+    ht_alloc_slots(ht, old_nslots * 2);
+    for (UINT64 i = 0; i < old_nslots; i++){
+        if ((old_occupied[i >> 6] >> (i & 63)) & 1){
+            UINT64 slot = ht_find_slot(ht, old_keys[i]);
+            ht -> keys[slot] = old_keys[i];
+            ht -> first[slot] = old_first[i];
+            ht -> occupied[slot >> 6] |= (UINT64)1 << (slot & 63);
+        }
     }
+    ht -> nkeys = nkeys;
 
-    // initialize each tuple slot in each page
-    for (UINT i = 0; i < nslots; i++){
-        for (INT np = 0; np < max_ntuples_per_page; np++){
-            Tuple each_tuple = malloc(sizeof(INT)*nattrs_max);
-            for (int na = 0; na < nattrs_max; na++){
-                each_tuple[na] = 0;
-            }
-            buffer_pool[i] -> tuples[np] = each_tuple;
+    free(old_keys);
+    free(old_first);
+    free(old_occupied);
+}
+
+// copy a row into hash table and link it into the chain of its key
+static void ht_insert(Hash_table* ht, const INT* row){
+    if (ht -> nrows == ht -> row_capacity){
+        UINT64 row_capacity = ht -> row_capacity * 2;
+        INT* rows = realloc(ht -> rows, sizeof(INT) * ht -> nattrs * row_capacity);
+        INT64* next = rows != NULL ? realloc(ht -> next, sizeof(INT64) * row_capacity) : NULL;
+        if (next == NULL){
+            printf("Fail to allocate %lu rows of hash table.\n", row_capacity);
+            exit(-1);
         }
+        ht -> rows = rows;
+        ht -> next = next;
+        ht -> row_capacity = row_capacity;
+    }
+    UINT64 r = ht -> nrows++;
+    memcpy(ht -> rows + r * ht -> nattrs, row, sizeof(INT) * ht -> nattrs);
+
+    INT key = row[ht -> idx];
+    UINT64 slot = ht_find_slot(ht, key);
+    if (ht_is_occupied(ht, slot)){
+        // rows with the same key are chained, so skewed keys never overflow
+        ht -> next[r] = ht -> first[slot];
+        ht -> first[slot] = r;
+        return;
     }
 
-    // get file limit to initialize file table
-    file_limit = cf -> file_limit;
+    ht -> keys[slot] = key;
+    ht -> first[slot] = r;
+    ht -> next[r] = -1;
+    ht -> occupied[slot >> 6] |= (UINT64)1 << (slot & 63);
+    ht -> nkeys++;
 
-    // initialize file table, with each element initialized to -1(unused)
-    file_table = malloc(sizeof(File) * file_limit);
-    for (UINT i = 0; i < file_limit; i++){
-        file_table[i].flag = UNUSED;
-        file_table[i].oid = 0;
-        file_table[i].file_opened = NULL;
+    if (ht -> nkeys * 2 > ht -> nslots){
+        ht_grow(ht);
     }
+}
 
-    printf("init() is invoked.\n");
+// first row with the key, -1 if there is no such row,
+// the following ones are found through ht -> next
+static inline INT64 ht_lookup(const Hash_table* ht, INT key){
+    UINT64 slot = ht_find_slot(ht, key);
+    return ht_is_occupied(ht, slot) ? ht -> first[slot] : -1;
 }
 
-// release buffer pool and file pointer table
-void release(){
+static inline INT* ht_row(const Hash_table* ht, INT64 r){
+    return ht -> rows + r * ht -> nattrs;
+}
 
-    // free each tuple and page stored in buffer
-    for (UINT i = 0; i < nslots; i++){
-       clean_buffer(i,2);
-    }
-    
-    // free buffer
-    free(buffer_pool);
+// remove all rows but keep the memory for reuse
+static void ht_clear(Hash_table* ht){
+    ht -> nrows = 0;
+    ht -> nkeys = 0;
+    memset(ht -> occupied, 0, sizeof(UINT64) * ((ht -> nslots + 63) / 64));
+}
 
-    // close each opened file
-    for (UINT i = 0; i < file_limit; i++){
-        if (file_table[i].flag != UNUSED){
-            fclose(file_table[i].file_opened);
+static void ht_free(Hash_table* ht){
+    free(ht -> rows);
+    free(ht -> next);
+    free(ht -> keys);
+    free(ht -> first);
+    free(ht -> occupied);
+}
+
+// prepare the ring of a sequential scan over npages pages, only a scan
+// over more than a quarter of buffer pool gets one, of at most an eighth
+// of buffer pool
+static void ring_init(Ring* ring, UINT64 npages){
+    UINT size = get_conf() -> ring_slots;
+    if (size > nslots / 8){
+        size = nslots / 8;
+    }
+    ring -> size = npages > nslots / 4 ? size : 0;
+    ring -> slots = NULL;
+    ring -> pos = 0;
+    if (ring -> size > 0){
+        ring -> slots = malloc(sizeof(INT) * ring -> size);
+        for (UINT i = 0; i < ring -> size; i++){
+            ring -> slots[i] = UNUSED;
         }
     }
-
-    // free file pointer table
-    free(file_table);
- 
-    printf("release() is invoked.\n");
 }
 
-_Table* sel(const UINT idx, const INT cond_val, const char* table_name){
-    printf("sel() is invoked.\n");
-
-    Table_meta table = get_table_meta(table_name);
-
-    // get meta data of table 1 
-    UINT oid = table.oid;
-    UINT nattrs  = table.nattrs;
-    UINT ntuples = table.ntuples;
-    INT ntuples_per_page = table.ntuples_per_page;
-    UINT64 npages =  table.npages;
+static void ring_free(Ring* ring){
+    free(ring -> slots);
+    ring -> slots = NULL;
+    ring -> size = 0;
+}
 
-    // temporary tuple to store resulting tuples
-    INT temp_table[ntuples][nattrs];
-    for (UINT i = 0; i < ntuples; i++){
-        for (UINT j = 0; j < nattrs; j++){
-            temp_table[i][j] = 0;
-        }
+// release a page we requested, decrease pin count by 1, needs no lock
+// as a page is only evicted once nobody pins it
+static void release_page(UINT page_index){
+    UINT pins = __atomic_load_n(&buffer_pool[page_index].pin_count, __ATOMIC_ACQUIRE);
+    while (pins != 0
+           && !__atomic_compare_exchange_n(&buffer_pool[page_index].pin_count, &pins, pins - 1,
+                                           false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+    }
+    if (pins != 0){
+        thread_pins--;
     }
+}
 
-    // number of tuples to return
-    UINT ntuple_ret = 0;
+// a buffer slot holding no page, pinned by the caller, to read pages of
+// temporary files into, which are in no page directory, the slot is
+// given back with release_page and is the first to be reused
+static UINT get_scratch_slot(){
+    while (true){
+        UINT slot = get_free_buffer_slot(0, (UINT)UNUSED);
+        if (buffer_pool[slot].flag == UNUSED){
+            return slot;
+        }
 
-    // read all page ids first
-    UINT64 pageId_array[npages];
-    get_page_ids(oid, npages,pageId_array);
-    
-    // for each page, first try to find it in buffer pool, if it doesn't
-    // exist in buffer pool, check whether it is opened in file pointer table
-    // is not, open it and store file pointer into file pointer table
-    for(UINT64 pid_index = 0; pid_index < npages; pid_index++){
-        // get current page id
-        UINT64 pid = pageId_array[pid_index];
-
-        UINT page_index = get_requested_page(pid,oid,ntuples_per_page,nattrs,npages);
-
-        // increase the count of tuples by checking whether the corresponding index of tuple
-        // contains the value we want
-        for (UINT tuple_index = 0; tuple_index < buffer_pool[page_index] -> ntuples; tuple_index++){
-            if (buffer_pool[page_index] -> tuples[tuple_index][idx] == cond_val){
-                // store tuple containning correct value
-                for (UINT j = 0; j < nattrs; j++){
-                    temp_table[ntuple_ret][j] = buffer_pool[page_index] -> tuples[tuple_index][j];
-                }
-                ntuple_ret++;
+        // evict the page of the slot unless somebody found it meanwhile
+        UINT64 bucket = buf_bucket(buf_table[slot].pid, buf_table[slot].oid);
+        pthread_rwlock_wrlock(buf_partition_lock(bucket));
+        bool evicted = __atomic_load_n(&buffer_pool[slot].pin_count, __ATOMIC_ACQUIRE) == 1;
+        if (evicted){
+            log_release_page(buffer_pool[slot].pid);
+            buf_table_delete(bucket, slot);
+            buffer_pool[slot].flag = UNUSED;
+            __atomic_store_n(&buffer_pool[slot].usage, 0, __ATOMIC_RELAXED);
+
+            // the slot holds no page for the policy either, temporary
+            // pages are never recorded in it
+            if (policy != POLICY_CLS){
+                pthread_mutex_lock(&repl_lock);
+                repl_forget(slot);
+                pthread_mutex_unlock(&repl_lock);
             }
         }
+        pthread_rwlock_unlock(buf_partition_lock(bucket));
+        if (evicted){
+            // the page of a mapped file was used in place
+            buffer_pool[slot].data = buffer_slab + frame_size * slot;
+            return slot;
+        }
+        release_page(slot);
+    }
+}
 
-        // release page, decrease pin count by 1
-        if (buffer_pool[page_index] -> pin_count != 0){
-            buffer_pool[page_index] -> pin_count--;
+// slot for a page the scan misses, the slot of the ring used longest ago
+// if nobody else pinned or used its page since the scan read it,
+// otherwise a slot chosen by the replacement policy, which joins the ring
+// the slot returned is pinned like one of get_free_buffer_slot, reused
+// tells whether it is the one of the ring
+static UINT ring_get_slot(Ring* ring, UINT64 pid, UINT oid, bool* reused){
+    INT slot = ring -> slots[ring -> pos];
+    *reused = false;
+    if (slot != UNUSED && __atomic_load_n(&buffer_pool[slot].usage, __ATOMIC_RELAXED) <= 1){
+        if (policy != POLICY_CLS){
+            pthread_mutex_lock(&repl_lock);
+        }
+        *reused = try_claim(slot);
+        if (policy != POLICY_CLS){
+            pthread_mutex_unlock(&repl_lock);
         }
     }
-    // create return table
-    _Table* ret_table =  malloc(sizeof(_Table)+ntuple_ret*sizeof(Tuple));
+    if (!*reused){
+        slot = get_free_buffer_slot(pid, oid);
+        ring -> slots[ring -> pos] = slot;
+    }
+    ring -> pos = (ring -> pos + 1) % ring -> size;
+    return slot;
+}
+
+// tell the replacement policy page (oid, pid) is stored in a slot we
+// claimed, only once the slot is surely given to it, as we may still find
+// the page read by another thread or lose the slot, a slot reused by a
+// ring stays the next one to evict
+static void install_page(UINT slot, bool reused, UINT64 pid, UINT oid){
+    if (policy == POLICY_CLS){
+        return;
+    }
+    pthread_mutex_lock(&repl_lock);
+    if (reused){
+        repl_reuse(slot, oid, pid);
+    }
+    else{
+        repl_commit(slot, oid, pid);
+    }
+    pthread_mutex_unlock(&repl_lock);
+}
 
-    ret_table -> nattrs = nattrs;
-    ret_table -> ntuples = ntuple_ret;
-    for (UINT i = 0; i < ntuple_ret; i++){
-        Tuple t = malloc(sizeof(INT)*ret_table->nattrs);
-        // copy each tuple from temporary tuples into return tuple
-        for (UINT attr = 0; attr < nattrs; attr++){
-            INT ret_attr = temp_table[i][attr];
-            t[attr] = ret_attr;
+// pin a page found in buffer mapping table, the lock of its partition is
+// held so the page cannot be evicted before it is pinned
+static void pin_found_page(UINT slot, bool use_ring){
+    __atomic_add_fetch(&nhits, 1, __ATOMIC_RELAXED);
+    if (policy != POLICY_CLS){
+        // policies with lists see every pin, see get_free_buffer_slot
+        pthread_mutex_lock(&repl_lock);
+        __atomic_add_fetch(&buffer_pool[slot].pin_count, 1, __ATOMIC_ACQ_REL);
+        if (!use_ring){
+            repl_hit(slot);
         }
-        ret_table -> tuples[i] = t;
+        pthread_mutex_unlock(&repl_lock);
+    }
+    else{
+        __atomic_add_fetch(&buffer_pool[slot].pin_count, 1, __ATOMIC_ACQ_REL);
     }
+    thread_pins++;
 
-    return ret_table;
+    // increase the popularity of page, a page of a ring scan only gets
+    // the popularity of a page read once
+    if (!use_ring){
+        __atomic_add_fetch(&buffer_pool[slot].usage, 1, __ATOMIC_RELAXED);
+    }
+    else{
+        UINT unused = 0;
+        __atomic_compare_exchange_n(&buffer_pool[slot].usage, &unused, 1,
+                                    false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
 }
 
-// block nested foor loop join
-static _Table* nested_for_loop_join(UINT oid_1,
-                                    UINT oid_2,
-                                    UINT64 npages_1,
-                                    UINT64 npages_2,
-                                    UINT ntuples_per_page_1,
-                                    UINT ntuples_per_page_2,
-                                    UINT nattrs_1,
-                                    UINT nattrs_2,
-                                    UINT idx1,
-                                    UINT idx2,
-                                    UINT ntuples_1,
-                                    UINT ntuples_2,
-                                    INT flag){
-    // read all page ids of table 1 first
-    UINT64 pageId_array_1[npages_1];
-    get_page_ids(oid_1, npages_1,pageId_array_1);
-    
-    // read all page ids of table 2
-    UINT64 pageId_array_2[npages_2];
-    get_page_ids(oid_2, npages_2,pageId_array_2);
+// lock the partitions of two buckets exclusively, in the order of their
+// locks so that two threads never wait for each other
+static void lock_partitions(UINT64 bucket_1, UINT64 bucket_2){
+    UINT p1 = bucket_1 % NUM_BUF_PARTITIONS;
+    UINT p2 = bucket_2 % NUM_BUF_PARTITIONS;
+    if (p1 > p2){
+        UINT p = p1;
+        p1 = p2;
+        p2 = p;
+    }
+    pthread_rwlock_wrlock(&buf_partition_locks[p1]);
+    if (p2 != p1){
+        pthread_rwlock_wrlock(&buf_partition_locks[p2]);
+    }
+}
 
-    // maximum tuples we can get after join
-    UINT64 max_tuples = ntuples_1*ntuples_2;
+static void unlock_partitions(UINT64 bucket_1, UINT64 bucket_2){
+    UINT p1 = bucket_1 % NUM_BUF_PARTITIONS;
+    UINT p2 = bucket_2 % NUM_BUF_PARTITIONS;
+    pthread_rwlock_unlock(&buf_partition_locks[p1]);
+    if (p2 != p1){
+        pthread_rwlock_unlock(&buf_partition_locks[p2]);
+    }
+}
+
+// pin a page in buffer pool, a scan with a ring reads it into a slot of
+// its ring and does not make the page look hot
+// threads may ask for pages at the same time: a page is looked up with
+// the lock of its partition of buffer mapping table held shared, a slot
+// to evict is pinned before it is chosen, and it is only given the new
+// page if nobody else pinned it, with the partitions of both pages locked,
+// the page is read afterwards with no lock but the content latch of the slot
+static UINT get_page_with_ring(UINT64 pid,UINT oid,INT ntuples_per_page,UINT nattrs,UINT64 npages,Ring* ring){
+    bool use_ring = ring != NULL && ring -> size > 0;
+    UINT64 bucket = buf_bucket(pid, oid);
+
+    // find the page in buffer mapping table
+    pthread_rwlock_rdlock(buf_partition_lock(bucket));
+    INT page_index = buf_table_lookup(bucket, pid, oid);
+    if (page_index != UNUSED){
+        pin_found_page(page_index, use_ring);
+    }
+    pthread_rwlock_unlock(buf_partition_lock(bucket));
+
+    // the page we query is not in buffer pool, find where it is in its
+    // file before a slot is given to it, a page the table does not have
+    // is an error rather than another page to read
+    INT64 result_pos = -1;
+    UINT page_ntuples = 0;
+    if (page_index == UNUSED){
+        pthread_mutex_lock(&file_lock);
+        Page_dir* dir = get_page_dir(oid, npages);
+        result_pos = get_page_pos(dir, pid);
+        if (result_pos != -1){
+            page_ntuples = get_page_ntuples(dir, result_pos, ntuples_per_page);
+        }
+        pthread_mutex_unlock(&file_lock);
+        if (result_pos == -1){
+            printf("Page %lu does not exist in table %u.\n", pid, oid);
+            exit(-1);
+        }
+    }
 
-    // temporary tuple to store resulting tuples
-    INT temp_table[max_tuples][nattrs_1 + nattrs_2];
+    bool miss = false;
+    while (page_index == UNUSED){
+        // implement clock-sweep replacement to get next free buffer
+        bool reused = false;
+        UINT victim = use_ring ? ring_get_slot(ring, pid, oid, &reused) : get_free_buffer_slot(pid, oid);
+
+        // nobody waits on the content latch of a slot nobody pinned, it is
+        // taken before the partitions so that reading a page, which takes
+        // file_lock with the latch held, never waits for a partition
+        pthread_mutex_lock(&buffer_pool[victim].content_latch);
+        bool evict = buffer_pool[victim].flag != UNUSED;
+        UINT64 old_bucket = evict ? buf_bucket(buf_table[victim].pid, buf_table[victim].oid) : bucket;
+        lock_partitions(old_bucket, bucket);
+
+        // another thread may have read the page meanwhile, or pinned the
+        // page of the victim, in which case we look for another victim
+        page_index = buf_table_lookup(bucket, pid, oid);
+        if (page_index != UNUSED){
+            pin_found_page(page_index, use_ring);
+        }
+        else if (__atomic_load_n(&buffer_pool[victim].pin_count, __ATOMIC_ACQUIRE) == 1){
+            if (evict){
+                log_release_page(buffer_pool[victim].pid);
+                buf_table_delete(old_bucket, victim);
+            }
 
-    for (UINT i = 0; i < max_tuples; i++){
-        for (UINT j = 0; j < nattrs_1 + nattrs_2; j++){
-            temp_table[i][j] = 0;
+            // update page meta data in buffer pool, the victim is pinned
+            // by us already
+            buffer_pool[victim].flag = 1;
+            buffer_pool[victim].oid = oid;
+            buffer_pool[victim].pid = pid;
+            buffer_pool[victim].ntuples_per_page = ntuples_per_page;
+            buffer_pool[victim].nattrs = nattrs;
+            buffer_pool[victim].ntuples = 0;
+            __atomic_store_n(&buffer_pool[victim].usage, 1, __ATOMIC_RELAXED);
+            buf_table_insert(bucket, pid, oid, victim);
+            install_page(victim, reused, pid, oid);
+
+            // whoever finds the page before it is read waits on content latch
+            __atomic_store_n(&buffer_pool[victim].io_in_progress, 1, __ATOMIC_RELAXED);
+            page_index = victim;
+            miss = true;
+        }
+        unlock_partitions(old_bucket, bucket);
+        if (!miss){
+            pthread_mutex_unlock(&buffer_pool[victim].content_latch);
+            release_page(victim);
         }
     }
 
-    // number of tuples to return
-    UINT ntuple_ret = 0;
+    if (miss){
+        __atomic_add_fetch(&nmisses, 1, __ATOMIC_RELAXED);
 
+        // the file may have been closed to open another one, it is kept
+        // open until the page is read
+        pthread_mutex_lock(&file_lock);
+        UINT file_index = get_file_entry(oid);
+        file_table[file_index].nreaders++;
+        Smgr_file query_file = file_table[file_index].file;
 
-    for (UINT64 pid_index_1 = 0; pid_index_1 < npages_1; pid_index_1++){
-        // get current page id
-        UINT64 pid_1 = pageId_array_1[pid_index_1];
+        // start reading page into buffer pool
+        log_read_page(pid);
+        pthread_mutex_unlock(&file_lock);
 
-        // request page from table 1, and increase pin count
-        get_requested_page(pid_1,oid_1,ntuples_per_page_1,nattrs_1,npages_1);
+        // read page from hard drive and store into buffer pool
+        read_into_buffer_pool(page_index, oid, result_pos, page_ntuples, &query_file);
 
-        // haven't read n-1 pages from table 1 and haven't reach the end of table 1
-        if ( (pid_index_1 % (nslots - 1)) != nslots - 2 ){
+        pthread_mutex_lock(&file_lock);
+        if (--file_table[file_index].nreaders == 0){
+            pthread_cond_broadcast(&file_idle);
+        }
+        pthread_mutex_unlock(&file_lock);
+
+        __atomic_store_n(&buffer_pool[page_index].io_in_progress, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&buffer_pool[page_index].content_latch);
+    }
+    else if (__atomic_load_n(&buffer_pool[page_index].io_in_progress, __ATOMIC_ACQUIRE)){
+        // another thread is still reading the page
+        pthread_mutex_lock(&buffer_pool[page_index].content_latch);
+        pthread_mutex_unlock(&buffer_pool[page_index].content_latch);
+    }
+
+    return page_index;
+}
+
+static UINT get_requested_page(UINT64 pid,UINT oid,INT ntuples_per_page,UINT nattrs,UINT64 npages){
+    return get_page_with_ring(pid, oid, ntuples_per_page, nattrs, npages, NULL);
+}
+
+// start reading the pages a sequential scan over pids asks for after it
+// reads page next, at most prefetch depth pages ahead of it, ahead is the
+// first page not considered yet and pages in buffer pool are skipped
+static void read_ahead(UINT oid, const UINT64* pids, UINT64 next, UINT64 npages, UINT64* ahead){
+    UINT64 end = next + prefetch_depth();
+    if (end > npages){
+        end = npages;
+    }
+    if (*ahead < next){
+        *ahead = next;
+    }
+    if (*ahead >= end){
+        return;
+    }
+
+    // the file is open as the scan just read a page of it, pages of a
+    // mapped file need no read
+    pthread_mutex_lock(&file_lock);
+    const Smgr_file* f = get_file_descriptor_from_table(oid);
+    Page_dir* dir = find_page_dir(oid);
+    if (f == NULL || f -> map != NULL || dir == NULL){
+        *ahead = end;
+    }
+    for (; *ahead < end; (*ahead)++){
+        UINT64 pid = pids[*ahead];
+        INT64 pos = get_page_pos(dir, pid);
+        if (pos == -1){
+            continue;
+        }
+        UINT64 bucket = buf_bucket(pid, oid);
+        pthread_rwlock_rdlock(buf_partition_lock(bucket));
+        bool resident = buf_table_lookup(bucket, pid, oid) != UNUSED;
+        pthread_rwlock_unlock(buf_partition_lock(bucket));
+        if (!resident){
+            prefetch_start(oid, pos, f);
+        }
+    }
+    pthread_mutex_unlock(&file_lock);
+}
+
+static Table_meta get_table_meta(const char* table1_name) {
+    struct Table_meta table;
+     
+    Database* db = get_db();
+    UINT ntables = db -> ntables;
+    
+    // get meta data of table 1 
+    for (UINT i = 0; i < ntables; i++){
+        char *each_table = db -> tables[i].name;
+        if (strcmp(each_table,table1_name) == 0){
+            table.oid = db -> tables[i].oid;
+            table.nattrs = db -> tables[i].nattrs;
+            table.ntuples = db -> tables[i].ntuples;
+            table.sorted_attrs = db -> tables[i].sorted_attrs;
+            table.stats = db -> tables[i].stats;
+            table.npages = db -> tables[i].npages;
+        }
+    }
+
+    // the number of pages comes from the catalog, an empty table has none
+    table.ntuples_per_page = (page_size-sizeof(UINT64))/sizeof(INT)/table.nattrs;
+
+    return table;
+}
+
+// statistics of attribute idx of a table, NULL if there are none
+static inline const Attr_stats* attr_stats(const Table_meta* table, UINT idx){
+    return table -> stats != NULL && idx < table -> nattrs ? &table -> stats[idx] : NULL;
+}
+
+// estimated number of distinct values of attribute idx
+static inline UINT64 attr_ndv(const Table_meta* table, UINT idx){
+    const Attr_stats* stats = attr_stats(table, idx);
+    if (stats == NULL){
+        return table -> ntuples > 0 ? table -> ntuples : 1;
+    }
+    return stats -> ndv;
+}
+
+// return all page id we read all the corresponding file
+static void get_page_ids(UINT oid, UINT64 npages, UINT64 pageId_array[]){    
+    
+    // page ids are read from page directory, which is built
+    // when we request the table for the first time
+    pthread_mutex_lock(&file_lock);
+    get_file_entry(oid);
+    Page_dir* dir = get_page_dir(oid, npages);
+
+    for (UINT64 i = 0; i < npages; i++){
+        pageId_array[i] = i < dir -> npages ? dir -> pids[i] : 0;
+    }
+    pthread_mutex_unlock(&file_lock);
+}
+
+// initialize buffer pool and file pointer table
+void init(){
+    // config all meta data
+    Conf* cf = get_conf();
+
+    // initialize page size
+    page_size = cf -> page_size;
+
+    // get number of buffer to initialize buffer_pool
+    nslots = cf -> buf_slots;
+
+    // page images of all buffer slots live in one aligned allocation,
+    // each slot starts on a cache line
+    frame_size = (page_size + 63) & ~(size_t)63;
+    if (posix_memalign((void**)&buffer_slab, 4096, frame_size * nslots) != 0){
+        perror("Fail to allocate buffer pool.\n");
+        exit(-1);
+    }
+    memset(buffer_slab, 0, frame_size * nslots);
+
+    // initialize descriptor of each buffer slot
+    buffer_pool = malloc(sizeof(Page) * nslots);
+    for (UINT i = 0; i < nslots; i++){
+        buffer_pool[i].data = buffer_slab + frame_size * i;
+        pthread_mutex_init(&buffer_pool[i].content_latch, NULL);
+        buffer_pool[i].io_in_progress = 0;
+        clean_buffer(i);
+    }
+
+    nvb = 0;
+
+    // buffer mapping table has at least as many buckets as slots
+    buf_nbuckets = 1;
+    while (buf_nbuckets < nslots){
+        buf_nbuckets <<= 1;
+    }
+    buf_buckets = malloc(sizeof(INT) * buf_nbuckets);
+    for (UINT64 i = 0; i < buf_nbuckets; i++){
+        buf_buckets[i] = UNUSED;
+    }
+    buf_table = malloc(sizeof(Buf_tag) * nslots);
+    for (UINT i = 0; i < nslots; i++){
+        buf_table[i].next = UNUSED;
+    }
+    for (UINT i = 0; i < NUM_BUF_PARTITIONS; i++){
+        pthread_rwlock_init(&buf_partition_locks[i], NULL);
+    }
+
+    // get file limit to initialize file table
+    file_limit = cf -> file_limit;
+
+    // initialize file table, with each element initialized to -1(unused)
+    file_table = malloc(sizeof(File) * file_limit);
+    for (UINT i = 0; i < file_limit; i++){
+        file_table[i].flag = UNUSED;
+        file_table[i].oid = 0;
+        file_table[i].file.fd = UNUSED;
+        file_table[i].file.map = NULL;
+        file_table[i].nreaders = 0;
+    }
+
+    // table and index files are read by the backend chosen in Conf
+    smgr_init(cf -> smgr, page_size);
+
+    // frames and worker threads reading pages of sequential scans ahead
+    prefetch_init(cf -> prefetch_depth, page_size);
+
+    // replacement policy, clock sweep needs no state beside usage counts
+    policy = repl_parse(cf -> buf_policy);
+    if (policy == NPOLICY){
+        policy = POLICY_CLS;
+    }
+    if (policy != POLICY_CLS){
+        repl_init(policy, nslots, is_pinned);
+    }
+    nhits = 0;
+    nmisses = 0;
+
+    // pick selection kernels for current cpu
+    init_filter();
+
+    printf("init() is invoked.\n");
+}
+
+// release buffer pool and file pointer table
+void release(){
+
+    // free buffer, all pages are stored in one slab
+    for (UINT i = 0; i < nslots; i++){
+        pthread_mutex_destroy(&buffer_pool[i].content_latch);
+    }
+    free(buffer_pool);
+    free(buffer_slab);
+    free(buf_table);
+    free(buf_buckets);
+    for (UINT i = 0; i < NUM_BUF_PARTITIONS; i++){
+        pthread_rwlock_destroy(&buf_partition_locks[i]);
+    }
+
+    // wait for pages still being read ahead before closing their files
+    prefetch_shutdown();
+
+    // close each opened file
+    for (UINT i = 0; i < file_limit; i++){
+        if (file_table[i].flag != UNUSED){
+            smgr_close(&file_table[i].file);
+        }
+    }
+    smgr_shutdown();
+
+    // free file pointer table
+    free(file_table);
+
+    // free page directory of each table
+    for (UINT i = 0; i < npage_dirs; i++){
+        free(page_dirs[i] -> pids);
+        free(page_dirs[i] -> sorted);
+        free(page_dirs[i]);
+    }
+    free(page_dirs);
+    page_dirs = NULL;
+    npage_dirs = 0;
+
+    // report how well the replacement policy kept pages we asked for
+    UINT64 nrequests = nhits + nmisses;
+    printf("Buffer pool (%s): %lu hits, %lu misses, hit ratio %.4f\n",
+           repl_name(policy), nhits, nmisses, nrequests > 0 ? (double)nhits / nrequests : 0.0);
+    if (policy != POLICY_CLS){
+        repl_free();
+    }
+ 
+    printf("release() is invoked.\n");
+}
+
+// partition a join key, uses the high bits of the hash so that the
+// hash table built on each partition still gets well spread low bits
+static inline UINT partition_of(INT key, UINT nparts){
+    UINT64 h = (UINT64)(UINT)key * 0x9E3779B97F4A7C15ULL;
+    return (UINT)((h >> 32) % nparts);
+}
+
+// create temporary files for partitions under the database folder, each
+// gets a unique name from mkstemp, so joins and sorts running at the same
+// time never share a file, the files are unlinked at once so they
+// disappear when closed
+static void open_partitions(Partition parts[], UINT nparts){
+    Database* db = get_db();
+    for (UINT i = 0; i < nparts; i++){
+        char path[PATH_MAX];
+        make_path(path, sizeof(path), db -> path, "tmp_join_XXXXXX");
+        INT fd = mkstemp(path);
+        parts[i].fp = fd != -1 ? fdopen(fd, "w+b") : NULL;
+        if (parts[i].fp == NULL){
+            perror("Fail to create temporary file for hash join.\n");
+            exit(-1);
+        }
+        unlink(path);
+
+        parts[i].page = NULL;
+        parts[i].ntuples = 0;
+        parts[i].npages = 0;
+    }
+}
+
+// write the output page of a partition to its file
+static void flush_partition(Partition* part){
+    if (part -> ntuples == 0){
+        return;
+    }
+    UINT64 ntuples = part -> ntuples;
+    memcpy(part -> page, &ntuples, sizeof(UINT64));
+    fwrite(part -> page, page_size, 1, part -> fp);
+    log_write_page(part -> npages);
+
+    part -> npages++;
+    part -> ntuples = 0;
+}
+
+// add a tuple to the output page of a partition, write the page when it is full
+static void append_partition(Partition* part, const INT* tuple, UINT nattrs, UINT ntuples_per_page){
+    INT* t = (INT*)(part -> page + sizeof(UINT64)) + (size_t)part -> ntuples * nattrs;
+    memcpy(t, tuple, sizeof(INT) * nattrs);
+    part -> ntuples++;
+    if (part -> ntuples == ntuples_per_page){
+        flush_partition(part);
+    }
+}
+
+// read the pos-th page of a partition, return number of tuples in it
+static UINT read_partition_page(Partition* part, UINT64 pos, INT8* page){
+    log_read_page(pos);
+    fseek(part -> fp, (INT64)page_size * pos, SEEK_SET);
+    if (fread(page, page_size, 1, part -> fp) != 1){
+        return 0;
+    }
+    UINT64 ntuples;
+    memcpy(&ntuples, page, sizeof(UINT64));
+    return ntuples;
+}
+
+static void close_partitions(Partition parts[], UINT nparts){
+    for (UINT i = 0; i < nparts; i++){
+        fclose(parts[i].fp);
+    }
+}
+
+// scan a table and spread its tuples over partitions by the join key, the
+// output page of each partition is a buffer slot pinned until the table is
+// partitioned, so with the page being read nparts + 1 slots are used
+static void partition_table(Partition parts[], UINT nparts, UINT oid, UINT64 npages,
+                            UINT ntuples_per_page, UINT nattrs, UINT idx){
+    UINT64* pageId_array = malloc(sizeof(UINT64) * npages);
+    get_page_ids(oid, npages, pageId_array);
+
+    reserve_pins(nparts + 1);
+    UINT* out_slots = malloc(sizeof(UINT) * nparts);
+    for (UINT i = 0; i < nparts; i++){
+        out_slots[i] = get_scratch_slot();
+        parts[i].page = buffer_pool[out_slots[i]].data;
+    }
+
+    for (UINT64 pid_index = 0; pid_index < npages; pid_index++){
+        UINT page_index = get_requested_page(pageId_array[pid_index],oid,ntuples_per_page,nattrs,npages);
+
+        for (UINT np = 0; np < buffer_pool[page_index].ntuples; np++){
+            Tuple t = page_tuple(page_index,np);
+            append_partition(&parts[partition_of(t[idx], nparts)], t, nattrs, ntuples_per_page);
+        }
+
+        // release page, decrease pin count by 1
+
+        release_page(page_index);
+    }
+    free(pageId_array);
+
+    for (UINT i = 0; i < nparts; i++){
+        flush_partition(&parts[i]);
+        parts[i].page = NULL;
+        release_page(out_slots[i]);
+    }
+    free(out_slots);
+    unreserve_pins(nparts + 1);
+}
+
+// order tuples by sort key, ties are broken by position to keep the order stable
+typedef struct Sort_item{
+    INT key;
+    UINT64 row;
+}Sort_item;
+
+static int cmp_sort_item(const void* a, const void* b){
+    const Sort_item* x = a;
+    const Sort_item* y = b;
+    if (x -> key != y -> key){
+        return x -> key < y -> key ? -1 : 1;
+    }
+    return (x -> row > y -> row) - (x -> row < y -> row);
+}
+
+// start reading a sorted run from its first page, the pages of the run
+// are read into a buffer slot the cursor keeps pinned until it is closed
+static void open_run_cursor(Run_cursor* c, Partition* run, UINT nattrs){
+    c -> run = run;
+    c -> nattrs = nattrs;
+    c -> npages = run -> npages;
+    c -> pos = 0;
+    c -> page_index = get_scratch_slot();
+    c -> page = buffer_pool[c -> page_index].data;
+    c -> ntuples = 0;
+    c -> i = 0;
+}
+
+// start scanning a table which is already sorted on the key
+static void open_table_cursor(Run_cursor* c, UINT oid, UINT64 npages, UINT ntuples_per_page, UINT nattrs){
+    c -> run = NULL;
+    c -> oid = oid;
+    c -> ntuples_per_page = ntuples_per_page;
+    c -> pids = malloc(sizeof(UINT64) * npages);
+    get_page_ids(oid, npages, c -> pids);
+    c -> nattrs = nattrs;
+    c -> npages = npages;
+    c -> pos = 0;
+    c -> page = NULL;
+    c -> page_index = UNUSED;
+    c -> ntuples = 0;
+    c -> i = 0;
+}
+
+// release the page of table, or the slot of run, the cursor holds
+static void unpin_cursor_page(Run_cursor* c){
+    if (c -> page_index != UNUSED){
+        release_page(c -> page_index);
+    }
+    c -> page_index = UNUSED;
+}
+
+// current tuple of cursor, NULL when all tuples are consumed
+static INT* cursor_tuple(Run_cursor* c){
+    while (c -> i == c -> ntuples){
+        if (c -> pos == c -> npages){
+            unpin_cursor_page(c);
+            return NULL;
+        }
+        if (c -> run != NULL){
+            c -> ntuples = read_partition_page(c -> run, c -> pos, c -> page);
+        }
+        else{
+            unpin_cursor_page(c);
+            c -> page_index = get_requested_page(c -> pids[c -> pos],c -> oid,c -> ntuples_per_page,c -> nattrs,c -> npages);
+            c -> ntuples = buffer_pool[c -> page_index].ntuples;
+        }
+        c -> pos++;
+        c -> i = 0;
+    }
+
+    if (c -> run != NULL){
+        return (INT*)(c -> page + sizeof(UINT64)) + (size_t)c -> i * c -> nattrs;
+    }
+    return page_tuple(c -> page_index, c -> i);
+}
+
+static inline void cursor_advance(Run_cursor* c){
+    c -> i++;
+}
+
+static void close_cursor(Run_cursor* c){
+    unpin_cursor_page(c);
+    if (c -> run == NULL){
+        free(c -> pids);
+    }
+}
+
+// restore heap order of merge, the cursor at heap[i] moves down
+static void sift_down(Run_cursor cursors[], UINT heap[], UINT nheap, UINT i, UINT idx){
+    while (true){
+        UINT smallest = i;
+        UINT l = 2 * i + 1;
+        UINT r = 2 * i + 2;
+        if (l < nheap && cursor_tuple(&cursors[heap[l]])[idx] < cursor_tuple(&cursors[heap[smallest]])[idx]){
+            smallest = l;
+        }
+        if (r < nheap && cursor_tuple(&cursors[heap[r]])[idx] < cursor_tuple(&cursors[heap[smallest]])[idx]){
+            smallest = r;
+        }
+        if (smallest == i){
+            return;
+        }
+        UINT t = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = t;
+        i = smallest;
+    }
+}
+
+// start writing a sorted run, its output page is kept outside buffer pool
+// since run generation holds every buffer slot pinned
+static void open_run(Partition* run){
+    open_partitions(run, 1);
+    run -> page = calloc(page_size, 1);
+}
+
+// write the last page of a run, which is only read from now on
+static void end_run(Partition* run){
+    flush_partition(run);
+    free(run -> page);
+    run -> page = NULL;
+}
+
+// merge sorted runs into one run with a heap of cursors
+static void merge_runs(Partition runs[], UINT nruns, Partition* out, UINT nattrs, UINT idx, UINT ntuples_per_page){
+    Run_cursor* cursors = malloc(sizeof(Run_cursor) * nruns);
+    UINT* heap = malloc(sizeof(UINT) * nruns);
+    UINT nheap = 0;
+
+    for (UINT i = 0; i < nruns; i++){
+        open_run_cursor(&cursors[i], &runs[i], nattrs);
+        if (cursor_tuple(&cursors[i]) != NULL){
+            heap[nheap++] = i;
+        }
+    }
+    for (INT i = (INT)nheap / 2 - 1; i >= 0; i--){
+        sift_down(cursors, heap, nheap, i, idx);
+    }
+
+    while (nheap > 0){
+        Run_cursor* c = &cursors[heap[0]];
+        append_partition(out, cursor_tuple(c), nattrs, ntuples_per_page);
+        cursor_advance(c);
+        if (cursor_tuple(c) == NULL){
+            heap[0] = heap[--nheap];
+        }
+        sift_down(cursors, heap, nheap, 0, idx);
+    }
+    end_run(out);
+
+    for (UINT i = 0; i < nruns; i++){
+        close_cursor(&cursors[i]);
+    }
+    free(cursors);
+    free(heap);
+}
+
+// external merge sort of a table on attribute idx, runs of nslots pages are
+// sorted in buffer pool, then merged nslots - 1 at a time until one run
+// is left, besides buffer pool only the sort keys of a run and the page
+// being written to a run are kept in memory
+static Partition* external_sort(UINT oid, UINT64 npages, UINT ntuples_per_page, UINT nattrs, UINT idx){
+    UINT64* pageId_array = malloc(sizeof(UINT64) * npages);
+    get_page_ids(oid, npages, pageId_array);
+
+    // run generation, the pages of a run stay pinned in buffer pool while
+    // the run is sorted, row k * ntuples_per_page + i of items is tuple i
+    // of the k-th page of the run
+    UINT64 run_capacity = (UINT64)nslots * ntuples_per_page;
+    Sort_item* items = malloc(sizeof(Sort_item) * run_capacity);
+    UINT* run_pages = malloc(sizeof(UINT) * nslots);
+
+    UINT nruns = (npages + nslots - 1) / nslots;
+    if (nruns == 0){
+        nruns = 1;
+    }
+    Partition* runs = malloc(sizeof(Partition) * nruns);
+
+    UINT run_pins = npages < nslots ? npages : nslots;
+    reserve_pins(run_pins);
+    UINT64 pid_index = 0;
+    for (UINT r = 0; r < nruns; r++){
+        UINT64 n = 0;
+        UINT nrun_pages = 0;
+        for (; nrun_pages < nslots && pid_index < npages; nrun_pages++, pid_index++){
+            UINT page_index = get_requested_page(pageId_array[pid_index],oid,ntuples_per_page,nattrs,npages);
+            run_pages[nrun_pages] = page_index;
+            for (UINT np = 0; np < buffer_pool[page_index].ntuples; np++){
+                items[n].key = page_tuple(page_index,np)[idx];
+                items[n].row = (UINT64)nrun_pages * ntuples_per_page + np;
+                n++;
+            }
+        }
+
+        qsort(items, n, sizeof(Sort_item), cmp_sort_item);
+        open_run(&runs[r]);
+        for (UINT64 k = 0; k < n; k++){
+            UINT page_index = run_pages[items[k].row / ntuples_per_page];
+            append_partition(&runs[r], page_tuple(page_index, items[k].row % ntuples_per_page), nattrs, ntuples_per_page);
+        }
+        end_run(&runs[r]);
+
+        // release pages of the run, decrease pin count by 1
+        for (UINT k = 0; k < nrun_pages; k++){
+            release_page(run_pages[k]);
+        }
+    }
+    unreserve_pins(run_pins);
+    free(items);
+    free(run_pages);
+    free(pageId_array);
+
+    // merge passes, one buffer slot per input run and one output page
+    UINT fan_in = nslots > 2 ? nslots - 1 : 2;
+    while (nruns > 1){
+        UINT nmerged = (nruns + fan_in - 1) / fan_in;
+        Partition* merged = malloc(sizeof(Partition) * nmerged);
+
+        for (UINT m = 0; m < nmerged; m++){
+            UINT first = m * fan_in;
+            UINT n = nruns - first < fan_in ? nruns - first : fan_in;
+            open_run(&merged[m]);
+            reserve_pins(n);
+            merge_runs(&runs[first], n, &merged[m], nattrs, idx, ntuples_per_page);
+            unreserve_pins(n);
+        }
+
+        close_partitions(runs, nruns);
+        free(runs);
+        runs = merged;
+        nruns = nmerged;
+    }
+
+    return runs;
+}
+
+// page I/O of sort-merge join on one table, an unsorted table is read,
+// written as runs, read and written once per merge pass, and read again
+// by merge join; a sorted table is only read by merge join
+static UINT64 sort_merge_cost(UINT64 npages, bool sorted){
+    if (sorted){
+        return npages;
+    }
+
+    // merging needs two input pages and one output page
+    if (nslots < 3){
+        return UINT64_MAX / 4;
+    }
+    UINT64 nruns = (npages + nslots - 1) / nslots;
+    UINT64 npasses = 0;
+    while (nruns > 1){
+        nruns = (nruns + nslots - 2) / (nslots - 1);
+        npasses++;
+    }
+    return 2 * npages * (1 + npasses) + npages;
+}
+
+// maximum number of entries in a leaf and in an inner node of an index
+static inline UINT leaf_capacity(){
+    return (page_size - sizeof(UINT64) - sizeof(Node_header)) / sizeof(Leaf_entry);
+}
+
+static inline UINT inner_capacity(){
+    return (page_size - sizeof(UINT64) - sizeof(Node_header)) / sizeof(Inner_entry);
+}
+
+static inline Node_header* node_header(INT8* page){
+    return (Node_header*)(page + sizeof(UINT64));
+}
+
+static inline Leaf_entry* leaf_entries(INT8* page){
+    return (Leaf_entry*)(page + sizeof(UINT64) + sizeof(Node_header));
+}
+
+static inline Inner_entry* inner_entries(INT8* page){
+    return (Inner_entry*)(page + sizeof(UINT64) + sizeof(Node_header));
+}
+
+// request a node of an index, the page id of a node is its page number
+// in the index file, nodes hold no tuples so nothing is trimmed
+static UINT get_index_page(const Index* index, UINT64 page){
+    return get_requested_page(page, index -> oid, 0, 1, index -> npages);
+}
+
+// order leaf entries by key, then by where the tuples are stored
+static int cmp_leaf_entry(const void* a, const void* b){
+    const Leaf_entry* x = a;
+    const Leaf_entry* y = b;
+    if (x -> key != y -> key) return (x -> key > y -> key) - (x -> key < y -> key);
+    if (x -> pos != y -> pos) return (x -> pos > y -> pos) - (x -> pos < y -> pos);
+    return (x -> slot > y -> slot) - (x -> slot < y -> slot);
+}
+
+// order leaf entries by where the tuples are stored
+static int cmp_rid(const void* a, const void* b){
+    const Leaf_entry* x = a;
+    const Leaf_entry* y = b;
+    if (x -> pos != y -> pos) return (x -> pos > y -> pos) - (x -> pos < y -> pos);
+    return (x -> slot > y -> slot) - (x -> slot < y -> slot);
+}
+
+// order matches of index nested loop join by where inner tuples are
+// stored, then by outer tuple
+static int cmp_rid_match(const void* a, const void* b){
+    const Probe_match* x = a;
+    const Probe_match* y = b;
+    if (x -> pos != y -> pos) return (x -> pos > y -> pos) - (x -> pos < y -> pos);
+    if (x -> slot != y -> slot) return (x -> slot > y -> slot) - (x -> slot < y -> slot);
+    return (x -> outer > y -> outer) - (x -> outer < y -> outer);
+}
+
+// write a node to its page of the index file
+static void write_index_page(FILE* fp, INT8* page, UINT64 pid){
+    memcpy(page, &pid, sizeof(UINT64));
+    fseek(fp, (INT64)page_size*pid, SEEK_SET);
+    fwrite(page, page_size, 1, fp);
+    log_write_page(pid);
+}
+
+void create_index(const UINT idx, const char* table_name){
+    printf("create_index() is invoked.\n");
+
+    Table_meta table = get_table_meta(table_name);
+    if (idx >= table.nattrs){
+        printf("Attribute %u does not exist in table %s.\n", idx, table_name);
+        return;
+    }
+    if (find_index(table.oid, idx) != NULL){
+        printf("Index on attribute %u of table %s already exists.\n", idx, table_name);
+        return;
+    }
+
+    // a node must hold at least two entries for the tree to branch
+    if (leaf_capacity() < 2 || inner_capacity() < 2){
+        printf("Page size %u is too small for an index.\n", page_size);
+        return;
+    }
+
+    // collect the key and position of every tuple, then sort them, the
+    // tree is built bottom up from the sorted entries
+    UINT64* pids = malloc(sizeof(UINT64) * table.npages);
+    get_page_ids(table.oid, table.npages, pids);
+    Leaf_entry* entries = malloc(sizeof(Leaf_entry) * (table.npages * table.ntuples_per_page + 1));
+    UINT64 nentries = 0;
+    for (UINT64 pos = 0; pos < table.npages; pos++){
+        UINT page_index = get_requested_page(pids[pos], table.oid, table.ntuples_per_page, table.nattrs, table.npages);
+        for (UINT i = 0; i < buffer_pool[page_index].ntuples; i++){
+            entries[nentries].key = page_tuple(page_index, i)[idx];
+            entries[nentries].pos = pos;
+            entries[nentries].slot = i;
+            nentries++;
+        }
+        release_page(page_index);
+    }
+    free(pids);
+    qsort(entries, nentries, sizeof(Leaf_entry), cmp_leaf_entry);
+
+    // the index file is stored in the database folder like table files
+    Index* index = add_index(table.oid, idx);
+    char path[PATH_MAX];
+    file_path(index -> oid, path, sizeof(path));
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL){
+        perror("Fail to create the index file.\n");
+        get_db() -> nindexes--;
+        free(entries);
+        return;
+    }
+
+    // leaves are filled completely since tables are never updated, they
+    // are the first pages of the file, linked in key order
+    INT8* page = calloc(page_size, 1);
+    UINT leaf_cap = leaf_capacity();
+    UINT64 nleaves = nentries == 0 ? 1 : (nentries + leaf_cap - 1) / leaf_cap;
+
+    // smallest key and page of each node of the level built last
+    Inner_entry* level = malloc(sizeof(Inner_entry) * nleaves);
+    for (UINT64 l = 0; l < nleaves; l++){
+        UINT64 first = l * leaf_cap;
+        UINT n = nentries - first < leaf_cap ? nentries - first : leaf_cap;
+
+        memset(page, 0, page_size);
+        node_header(page) -> is_leaf = 1;
+        node_header(page) -> nentries = n;
+        node_header(page) -> next = l + 1 < nleaves ? (INT)(l + 1) : UNUSED;
+        memcpy(leaf_entries(page), entries + first, sizeof(Leaf_entry) * n);
+        write_index_page(fp, page, l);
+
+        level[l].key = n > 0 ? entries[first].key : 0;
+        level[l].child = l;
+    }
+
+    // each inner level points to the nodes of the level below, until a
+    // level has a single node, the root
+    UINT inner_cap = inner_capacity();
+    UINT64 next_page = nleaves;
+    UINT64 nlevel = nleaves;
+    UINT height = 1;
+    while (nlevel > 1){
+        UINT64 nparents = (nlevel + inner_cap - 1) / inner_cap;
+        for (UINT64 p = 0; p < nparents; p++){
+            UINT64 first = p * inner_cap;
+            UINT n = nlevel - first < inner_cap ? nlevel - first : inner_cap;
+
+            memset(page, 0, page_size);
+            node_header(page) -> is_leaf = 0;
+            node_header(page) -> nentries = n;
+            node_header(page) -> next = UNUSED;
+            memcpy(inner_entries(page), level + first, sizeof(Inner_entry) * n);
+            write_index_page(fp, page, next_page);
+
+            // entries before first are written already, so the parent
+            // level can overwrite them
+            level[p].key = level[first].key;
+            level[p].child = next_page;
+            next_page++;
+        }
+        nlevel = nparents;
+        height++;
+    }
+    fclose(fp);
+
+    index -> height = height;
+    index -> root = next_page - 1;
+    index -> npages = next_page;
+    index -> nleaves = nleaves;
+    index -> nentries = nentries;
+
+    // the index is kept when the database is opened again
+    save_catalog();
+
+    free(level);
+    free(page);
+    free(entries);
+}
+
+// keys a predicate selects, as a range lo <= key <= hi
+// return false if the predicate is not a range, i.e. !=
+static bool pred_range(const Predicate* pred, INT64* lo, INT64* hi){
+    *lo = INT32_MIN;
+    *hi = INT32_MAX;
+    switch (pred -> op){
+        case CMP_EQ: *lo = pred -> lo; *hi = pred -> lo; return true;
+        case CMP_LT: *hi = (INT64)pred -> lo - 1; return true;
+        case CMP_LE: *hi = pred -> lo; return true;
+        case CMP_GT: *lo = (INT64)pred -> lo + 1; return true;
+        case CMP_GE: *lo = pred -> lo; return true;
+        case CMP_BETWEEN: *lo = pred -> lo; *hi = pred -> hi; return true;
+        default: return false;
+    }
+}
+
+// find the leaf where entries with keys not below key start
+static UINT64 find_leaf(const Index* index, INT64 key){
+    UINT64 page = index -> root;
+    for (UINT level = index -> height; level > 1; level--){
+        UINT page_index = get_index_page(index, page);
+        INT8* data = buffer_pool[page_index].data;
+        Inner_entry* e = inner_entries(data);
+
+        // the last child whose smallest key is below key, keys equal to
+        // key may end that child
+        UINT low = 1;
+        UINT high = node_header(data) -> nentries;
+        while (low < high){
+            UINT mid = low + (high - low) / 2;
+            if (e[mid].key < key){
+                low = mid + 1;
+            }
+            else{
+                high = mid;
+            }
+        }
+        page = e[low - 1].child;
+        release_page(page_index);
+    }
+    return page;
+}
+
+// collect entries of an index with lo <= key <= hi, in key order
+static Leaf_entry* index_lookup(const Index* index, INT64 lo, INT64 hi, UINT64* nrids){
+    Leaf_entry* rids = NULL;
+    UINT64 capacity = 0;
+    *nrids = 0;
+    if (lo > hi){
+        return rids;
+    }
+
+    INT64 page = find_leaf(index, lo);
+    while (page != UNUSED){
+        UINT page_index = get_index_page(index, page);
+        INT8* data = buffer_pool[page_index].data;
+        UINT n = node_header(data) -> nentries;
+        Leaf_entry* e = leaf_entries(data);
+
+        // first entry not below lo
+        UINT i = 0;
+        UINT high = n;
+        while (i < high){
+            UINT mid = i + (high - i) / 2;
+            if (e[mid].key < lo){
+                i = mid + 1;
+            }
+            else{
+                high = mid;
+            }
+        }
+
+        for (; i < n && e[i].key <= hi; i++){
+            if (*nrids == capacity){
+                capacity = capacity == 0 ? 64 : capacity * 2;
+                rids = realloc(rids, sizeof(Leaf_entry) * capacity);
+            }
+            rids[(*nrids)++] = e[i];
+        }
+
+        // keys beyond hi are in this leaf, no need to read the next one
+        page = i < n ? UNUSED : node_header(data) -> next;
+        release_page(page_index);
+    }
+    return rids;
+}
+
+// estimated page reads of index nested loop join, the outer table is read
+// once, each batch of probes reads inner nodes, about one leaf per probe
+// and at most each page of the inner table once
+static UINT64 index_join_cost(const Table_meta* outer, const Table_meta* inner, const Index* index){
+    double matches_per_probe = (double)index -> nentries / attr_ndv(inner, index -> idx);
+    UINT64 nbatches = (outer -> ntuples + PROBE_BATCH - 1) / PROBE_BATCH;
+    double nprobes = outer -> ntuples < PROBE_BATCH ? outer -> ntuples : PROBE_BATCH;
+    double nmatches = nprobes * matches_per_probe;
+
+    double nleaves = nprobes < index -> nleaves ? nprobes : index -> nleaves;
+    double nheap = nmatches < inner -> npages ? nmatches : inner -> npages;
+    return outer -> npages + (UINT64)(nbatches * (index -> height - 1 + nleaves + nheap));
+}
+
+// estimated page reads of selecting lo <= key <= hi with an index, the
+// number of selected entries comes from the histogram of the key
+static double index_scan_cost(const Index* index, const Table_meta* table, INT64 lo, INT64 hi){
+    const Attr_stats* stats = attr_stats(table, index -> idx);
+    double fraction = lo == hi ? eq_selectivity(stats, lo) : range_selectivity(stats, lo, hi);
+    double nselected = fraction * index -> nentries;
+
+    // inner nodes on the way down, leaves holding the entries, and at
+    // most one read of each page of the table
+    double nleaves = (UINT64)(nselected / leaf_capacity()) + 1;
+    double nheap = nselected < table -> npages ? nselected : table -> npages;
+    return index -> height - 1 + nleaves + nheap;
+}
+
+
+static inline bool batch_full(const Tuple_buf* batch){
+    return batch -> ntuples >= BATCH_SIZE;
+}
+
+// create an operator, state is owned and freed by the operator
+static Operator* new_operator(UINT nattrs,
+                              void (*open)(Operator*),
+                              void (*next)(Operator*, Tuple_buf*),
+                              void (*close)(Operator*),
+                              void* state){
+    Operator* op = malloc(sizeof(Operator));
+    op -> nattrs = nattrs;
+    op -> open = open;
+    op -> next = next;
+    op -> close = close;
+    op -> state = state;
+    op -> est_ntuples = 0;
+    return op;
+}
+
+void op_open(Operator* op){
+    op -> open(op);
+}
+
+UINT op_next(Operator* op, Tuple_buf* batch){
+    batch -> nattrs = op -> nattrs;
+    batch -> ntuples = 0;
+    op -> next(op, batch);
+    return batch -> ntuples;
+}
+
+void op_close(Operator* op){
+    op -> close(op);
+    free(op -> state);
+    free(op);
+}
+
+// run an operator to the end and collect all its tuples into a _Table
+_Table* op_materialize(Operator* op){
+    Tuple_buf result = {op -> nattrs, 0, 0, NULL};
+    Tuple_buf batch = {op -> nattrs, 0, 0, NULL};
+
+    // room for the estimated result at once instead of growing step by
+    // step, up to a few batches as the estimate may be far too large
+    UINT64 reserved = op -> est_ntuples;
+    if (reserved > (UINT64)MAX_RESERVED_BATCHES * BATCH_SIZE){
+        reserved = (UINT64)MAX_RESERVED_BATCHES * BATCH_SIZE;
+    }
+    reserve_tuples(&result, reserved);
+
+    op_open(op);
+    while (op_next(op, &batch) > 0){
+        append_tuples(&result, batch.data, batch.ntuples);
+    }
+    op_close(op);
+    free(batch.data);
+
+    return tuple_buf_to_table(&result);
+}
+
+// number of threads scanning a table for a selection, every thread pins
+// one page at a time so at least one slot is always left to evict
+static UINT parallel_workers(const Table_meta* table){
+    UINT n = get_conf() -> parallel_workers;
+    if (n + 1 > nslots){
+        n = nslots - 1;
+    }
+    UINT64 nchunks = (table -> npages + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+    if (n > nchunks){
+        n = nchunks;
+    }
+    return n > 1 ? n : 1;
+}
+
+// thread of a parallel scan, filters chunks of pages until none is left
+static void* parallel_scan_worker(void* arg){
+    Parallel_scan* ps = arg;
+    const Scan_state* st = ps -> scan;
+    const Table_meta* table = &st -> table;
+
+    // each thread evaluates the condition with its own state and reads
+    // pages into its own ring
+    Filter filter;
+    open_filter(&filter, &st -> cond, table -> ntuples_per_page);
+    UINT* sel_vec = malloc(sizeof(UINT) * (table -> ntuples_per_page + 1));
+    Ring ring;
+    ring_init(&ring, table -> npages);
+    UINT64 ahead = 0;
+
+    while (true){
+        UINT64 c = __atomic_fetch_add(&ps -> next_chunk, 1, __ATOMIC_RELAXED);
+        if (c >= ps -> nchunks){
+            break;
+        }
+        Tuple_buf* out = &ps -> chunks[c];
+        UINT64 end = (c + 1) * PARALLEL_CHUNK;
+        if (end > table -> npages){
+            end = table -> npages;
+        }
+        for (UINT64 pos = c * PARALLEL_CHUNK; pos < end; pos++){
+            UINT page_index = get_page_with_ring(st -> pids[pos],table -> oid,table -> ntuples_per_page,table -> nattrs,table -> npages,&ring);
+            read_ahead(table -> oid, st -> pids, pos + 1, end, &ahead);
+
+            UINT nsel = filter_page(&filter, page_tuple(page_index, 0), buffer_pool[page_index].ntuples, table -> nattrs, sel_vec);
+            for (UINT i = 0; i < nsel; i++){
+                append_tuples(out, page_tuple(page_index, sel_vec[i]), 1);
+            }
+            release_page(page_index);
+        }
+    }
+
+    free(sel_vec);
+    close_filter(&filter);
+    ring_free(&ring);
+    return NULL;
+}
+
+// run fn(arg) on nworkers threads, the calling thread being one of them,
+// and wait for all of them, work left by threads that cannot be started
+// is done by the others
+static void run_parallel(UINT nworkers, void* (*fn)(void*), void* arg){
+    pthread_t threads[nworkers];
+    UINT nstarted = 0;
+    while (nstarted + 1 < nworkers && pthread_create(&threads[nstarted], NULL, fn, arg) == 0){
+        nstarted++;
+    }
+    fn(arg);
+    for (UINT i = 0; i < nstarted; i++){
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// concatenate the buffers of n chunks into result and free them
+static void gather_chunks(Tuple_buf* result, UINT nattrs, Tuple_buf* chunks, UINT64 n){
+    UINT64 ntuples = 0;
+    for (UINT64 c = 0; c < n; c++){
+        ntuples += chunks[c].ntuples;
+    }
+    *result = (Tuple_buf){nattrs, 0, 0, NULL};
+    reserve_tuples(result, ntuples);
+    for (UINT64 c = 0; c < n; c++){
+        append_tuples(result, chunks[c].data, chunks[c].ntuples);
+        free(chunks[c].data);
+    }
+}
+
+// add the tuples of result from *r on to batch until it is full
+static void next_from_result(const Tuple_buf* result, UINT64* r, Tuple_buf* batch){
+    if (*r < result -> ntuples && !batch_full(batch)){
+        UINT64 n = result -> ntuples - *r;
+        if (n > BATCH_SIZE - batch -> ntuples){
+            n = BATCH_SIZE - batch -> ntuples;
+        }
+        append_tuples(batch, result -> data + *r * result -> nattrs, n);
+        *r += n;
+    }
+}
+
+// scan the whole table with nworkers threads, tuples are put in result
+// in the order a sequential scan returns them
+static void parallel_scan(Scan_state* st, UINT nworkers){
+    Parallel_scan ps;
+    ps.scan = st;
+    ps.next_chunk = 0;
+    ps.nchunks = (st -> table.npages + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+    ps.chunks = malloc(sizeof(Tuple_buf) * ps.nchunks);
+    for (UINT64 c = 0; c < ps.nchunks; c++){
+        ps.chunks[c] = (Tuple_buf){st -> table.nattrs, 0, 0, NULL};
+    }
+
+    run_parallel(nworkers, parallel_scan_worker, &ps);
+    gather_chunks(&st -> result, st -> table.nattrs, ps.chunks, ps.nchunks);
+    free(ps.chunks);
+}
+
+static void scan_open(Operator* op){
+    Scan_state* st = op -> state;
+
+    // read all page ids first
+    st -> pids = malloc(sizeof(UINT64) * st -> table.npages);
+    get_page_ids(st -> table.oid, st -> table.npages, st -> pids);
+    st -> pos = 0;
+    st -> page_index = UNUSED;
+    st -> i = 0;
+    st -> nsel = 0;
+    st -> ahead = 0;
+    ring_init(&st -> ring, st -> table.npages);
+
+    // selection vector holds indices of matching tuples of one page
+    st -> sel_vec = malloc(sizeof(UINT) * (st -> table.ntuples_per_page + 1));
+    open_filter(&st -> filter, &st -> cond, st -> table.ntuples_per_page);
+
+    // a large table may be scanned by several threads at once, the
+    // tuples found are then returned from result
+    UINT nworkers = parallel_workers(&st -> table);
+    st -> parallel = nworkers > 1;
+    st -> r = 0;
+    if (st -> parallel){
+        parallel_scan(st, nworkers);
+    }
+}
+
+static void scan_next(Operator* op, Tuple_buf* batch){
+    Scan_state* st = op -> state;
+    UINT nattrs = st -> table.nattrs;
+
+    if (st -> parallel){
+        next_from_result(&st -> result, &st -> r, batch);
+        return;
+    }
+
+    // for each page, first try to find it in buffer pool, if it doesn't
+    // exist in buffer pool, check whether it is opened in file pointer table
+    // is not, open it and store file pointer into file pointer table
+    while (!batch_full(batch)){
+        if (st -> page_index == UNUSED){
+            if (st -> pos == st -> table.npages){
+                return;
+            }
+            st -> page_index = get_page_with_ring(st -> pids[st -> pos],st -> table.oid,st -> table.ntuples_per_page,nattrs,st -> table.npages,&st -> ring);
+            st -> pos++;
+            st -> i = 0;
+            read_ahead(st -> table.oid, st -> pids, st -> pos, st -> table.npages, &st -> ahead);
+
+            // compare the whole page at once, only matching tuples are
+            // copied afterwards
+            UINT page_index = st -> page_index;
+            st -> nsel = filter_page(&st -> filter, page_tuple(page_index, 0), buffer_pool[page_index].ntuples, nattrs, st -> sel_vec);
+        }
+
+        // store tuples containning correct value, stop when batch is full
+        // and continue from the same tuple next time
+        UINT page_index = st -> page_index;
+        for (; st -> i < st -> nsel && !batch_full(batch); st -> i++){
+            append_tuples(batch, page_tuple(page_index, st -> sel_vec[st -> i]), 1);
+        }
+
+        // release page, decrease pin count by 1
+        if (st -> i == st -> nsel){
+            release_page(page_index);
+            st -> page_index = UNUSED;
+        }
+    }
+}
+
+static void scan_close(Operator* op){
+    Scan_state* st = op -> state;
+    if (st -> page_index != UNUSED){
+        release_page(st -> page_index);
+    }
+    free(st -> pids);
+    free(st -> sel_vec);
+    close_filter(&st -> filter);
+    ring_free(&st -> ring);
+    if (st -> parallel){
+        free(st -> result.data);
+    }
+}
+
+static void index_open(Operator* op){
+    Index_state* st = op -> state;
+
+    st -> pids = malloc(sizeof(UINT64) * st -> table.npages);
+    get_page_ids(st -> table.oid, st -> table.npages, st -> pids);
+
+    // entries of the keys selected, sorted by position so each page of
+    // the table is read once and tuples come out in the order of a scan
+    INT64 lo;
+    INT64 hi;
+    pred_range(&st -> cond.preds[st -> key_pred], &lo, &hi);
+    st -> rids = index_lookup(&st -> index, lo, hi, &st -> nrids);
+    if (st -> nrids > 0){
+        qsort(st -> rids, st -> nrids, sizeof(Leaf_entry), cmp_rid);
+    }
+    st -> r = 0;
+
+    st -> page_index = UNUSED;
+    st -> i = 0;
+    st -> nsel = 0;
+    st -> sel_vec = malloc(sizeof(UINT) * (st -> table.ntuples_per_page + 1));
+    open_filter(&st -> filter, &st -> cond, st -> table.ntuples_per_page);
+}
+
+static void index_next(Operator* op, Tuple_buf* batch){
+    Index_state* st = op -> state;
+    UINT nattrs = st -> table.nattrs;
+
+    while (!batch_full(batch)){
+        if (st -> page_index == UNUSED){
+            if (st -> r == st -> nrids){
+                return;
+            }
+            UINT pos = st -> rids[st -> r].pos;
+            st -> page_index = get_requested_page(st -> pids[pos],st -> table.oid,st -> table.ntuples_per_page,nattrs,st -> table.npages);
+
+            // tuples of the page the index points to, the other predicates
+            // of the condition are tested on them
+            UINT n = 0;
+            for (; st -> r < st -> nrids && st -> rids[st -> r].pos == pos; st -> r++){
+                st -> sel_vec[n++] = st -> rids[st -> r].slot;
+            }
+            st -> nsel = filter_list(&st -> filter, page_tuple(st -> page_index, 0), nattrs, st -> sel_vec, n);
+            st -> i = 0;
+        }
+
+        UINT page_index = st -> page_index;
+        for (; st -> i < st -> nsel && !batch_full(batch); st -> i++){
+            append_tuples(batch, page_tuple(page_index, st -> sel_vec[st -> i]), 1);
+        }
+
+        if (st -> i == st -> nsel){
+            release_page(page_index);
+            st -> page_index = UNUSED;
+        }
+    }
+}
+
+static void index_close(Operator* op){
+    Index_state* st = op -> state;
+    if (st -> page_index != UNUSED){
+        release_page(st -> page_index);
+    }
+    free(st -> pids);
+    free(st -> rids);
+    free(st -> sel_vec);
+    close_filter(&st -> filter);
+}
+
+// estimated fraction of tuples of a table matching a condition, predicates
+// are assumed to be independent
+static double cond_selectivity(const Table_meta* table, const Condition* cond){
+    double fraction = cond -> conn == CONJ_AND ? 1 : 0;
+    for (UINT k = 0; k < cond -> npreds; k++){
+        const Predicate* pred = &cond -> preds[k];
+        const Attr_stats* stats = attr_stats(table, pred -> idx);
+        double f;
+        INT64 lo;
+        INT64 hi;
+        if (pred -> op == CMP_EQ){
+            f = eq_selectivity(stats, pred -> lo);
+        }
+        else if (pred -> op == CMP_NE){
+            f = 1 - eq_selectivity(stats, pred -> lo);
+        }
+        else{
+            f = pred_range(pred, &lo, &hi) ? range_selectivity(stats, lo, hi) : 0;
+        }
+
+        if (cond -> conn == CONJ_AND){
+            fraction *= f;
+        }
+        else{
+            fraction = fraction + f - fraction * f;
+        }
+    }
+    return fraction;
+}
+
+// pick the predicate of a conjunction an index answers most cheaply,
+// return UNUSED if scanning the table is cheaper
+static INT choose_index(const Table_meta* table, const Condition* cond){
+    if (cond -> conn != CONJ_AND && cond -> npreds > 1){
+        return UNUSED;
+    }
+
+    INT best = UNUSED;
+    double best_cost = table -> npages;
+    for (UINT k = 0; k < cond -> npreds; k++){
+        const Index* index = find_index(table -> oid, cond -> preds[k].idx);
+        INT64 lo;
+        INT64 hi;
+        if (index == NULL || !pred_range(&cond -> preds[k], &lo, &hi)){
             continue;
         }
+        double cost = index_scan_cost(index, table, lo, hi);
+        if (cost < best_cost){
+            best = k;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
 
-         // read n - 1 pages from table 1, start compare them with table 2
-        for (UINT64 pid_index_2 = 0; pid_index_2 < npages_2; pid_index_2++){
-            // get current page id
-            UINT64 pid_2 = pageId_array_2[pid_index_2];
-
-            UINT page_index_2 = get_requested_page(pid_2,oid_2,ntuples_per_page_2,nattrs_2,npages_2);
-
-            // compare all tuples of current page from table 2
-            for (UINT np_2 = 0; np_2 < buffer_pool[page_index_2] -> ntuples; np_2++){
-                
-                // treaverse buffer pool to find pages of table 1
-                for (UINT table_1_index = 0; table_1_index < nslots; table_1_index++){
-                    // find a page from table 1
-                    if (buffer_pool[table_1_index] -> oid == oid_1){
-                        for (UINT np_1 = 0; np_1 < buffer_pool[table_1_index] -> ntuples; np_1++){
-                            
-                            // find one matching tuple, add to result table
-                            if (buffer_pool[table_1_index] -> tuples[np_1][idx1] == buffer_pool[page_index_2] -> tuples[np_2][idx2]){
-                                
-                                // store each attribute of tuple from table 1 and 2 into temp_table
-                                UINT na = 0;
-
-                                // store the attribute of table 1 first
-                                if (flag == 0){
-                                    for (UINT na_1 = 0; na_1 < nattrs_1; na_1++){
-                                        temp_table[ntuple_ret][na] = buffer_pool[table_1_index] -> tuples[np_1][na_1];
-                                        na++;
-                                    }
-                                    for (UINT na_2 = 0; na_2 < nattrs_2; na_2++){
-                                        temp_table[ntuple_ret][na] = buffer_pool[page_index_2] -> tuples[np_2][na_2];
-                                        na++;
-                                    }
-                                }
-
-                                // store the attribute of table 2 first
-                                if (flag == 1){
-                                    for (UINT na_2 = 0; na_2 < nattrs_2; na_2++){
-                                        temp_table[ntuple_ret][na] = buffer_pool[page_index_2] -> tuples[np_2][na_2];
-                                        na++;
-                                    }
-                                    for (UINT na_1 = 0; na_1 < nattrs_1; na_1++){
-                                        temp_table[ntuple_ret][na] = buffer_pool[table_1_index] -> tuples[np_1][na_1];
-                                        na++;
-                                    }
-                                }
-
-                                ntuple_ret += 1;
-                            }
-                        }
-                    }
+// selection as an operator, tuples are returned batch by batch
+Operator* sel_cond_op(const Condition* cond, const char* table_name){
+    printf("sel() is invoked.\n");
+
+    Table_meta table = get_table_meta(table_name);
+
+    // use an index on one of the attributes if it reads fewer pages
+    INT key_pred = choose_index(&table, cond);
+    if (key_pred != UNUSED){
+        Index_state* st = malloc(sizeof(Index_state));
+        st -> table = table;
+        st -> cond = *cond;
+        st -> index = *find_index(table.oid, cond -> preds[key_pred].idx);
+        st -> key_pred = key_pred;
+        st -> pids = NULL;
+        st -> rids = NULL;
+        st -> sel_vec = NULL;
+        st -> filter.in = NULL;
+        st -> filter.out = NULL;
+        st -> page_index = UNUSED;
+        Operator* op = new_operator(table.nattrs, index_open, index_next, index_close, st);
+        op -> est_ntuples = (UINT64)(cond_selectivity(&table, cond) * table.ntuples + 0.5);
+        return op;
+    }
+
+    Scan_state* st = malloc(sizeof(Scan_state));
+    st -> table = table;
+    st -> cond = *cond;
+    st -> pids = NULL;
+    st -> sel_vec = NULL;
+    st -> filter.in = NULL;
+    st -> filter.out = NULL;
+    st -> page_index = UNUSED;
+    st -> parallel = false;
+
+    Operator* op = new_operator(st -> table.nattrs, scan_open, scan_next, scan_close, st);
+    op -> est_ntuples = (UINT64)(cond_selectivity(&table, cond) * table.ntuples + 0.5);
+    return op;
+}
+
+Operator* sel_pred_op(const Predicate* pred, const char* table_name){
+    Condition cond = {CONJ_AND, 1, {*pred}};
+    return sel_cond_op(&cond, table_name);
+}
+
+Operator* sel_op(const UINT idx, const INT cond_val, const char* table_name){
+    Predicate pred = {idx, CMP_EQ, cond_val, cond_val};
+    return sel_pred_op(&pred, table_name);
+}
+
+_Table* sel_pred(const Predicate* pred, const char* table_name){
+    return op_materialize(sel_pred_op(pred, table_name));
+}
+
+_Table* sel_cond(const Condition* cond, const char* table_name){
+    return op_materialize(sel_cond_op(cond, table_name));
+}
+
+_Table* sel(const UINT idx, const INT cond_val, const char* table_name){
+    return op_materialize(sel_op(idx, cond_val, table_name));
+}
+
+// block nested foor loop join, nslots - 1 pages of the outer table are kept
+// in buffer pool while the inner table is scanned
+static void nested_open(Operator* op){
+    Nested_state* st = op -> state;
+
+    // read all page ids of both tables first
+    st -> pids_outer = malloc(sizeof(UINT64) * st -> outer.npages);
+    get_page_ids(st -> outer.oid, st -> outer.npages, st -> pids_outer);
+    st -> pids_inner = malloc(sizeof(UINT64) * st -> inner.npages);
+    get_page_ids(st -> inner.oid, st -> inner.npages, st -> pids_inner);
+
+    // the block and the inner page are pinned at once
+    st -> block_size = nslots > 1 ? nslots - 1 : 1;
+    reserve_pins(st -> block_size + 1);
+    st -> block = malloc(sizeof(UINT) * st -> block_size);
+    st -> nblock = 0;
+    st -> pos_outer = 0;
+    st -> pos_inner = 0;
+    st -> ahead_inner = 0;
+    st -> page_index_inner = UNUSED;
+    ring_init(&st -> ring_inner, st -> inner.npages);
+}
+
+static void nested_next(Operator* op, Tuple_buf* batch){
+    Nested_state* st = op -> state;
+    UINT nattrs_outer = st -> outer.nattrs;
+    UINT nattrs_inner = st -> inner.nattrs;
+
+    while (true){
+        // read the next n - 1 pages of outer table, they stay pinned
+        // until the whole inner table is compared with them
+        if (st -> nblock == 0){
+            if (st -> pos_outer == st -> outer.npages){
+                return;
+            }
+            while (st -> nblock < st -> block_size && st -> pos_outer < st -> outer.npages){
+                UINT page_index = get_requested_page(st -> pids_outer[st -> pos_outer],st -> outer.oid,st -> outer.ntuples_per_page,nattrs_outer,st -> outer.npages);
+
+                // keep pages of the block in the order of buffer slots
+                UINT k = st -> nblock;
+                while (k > 0 && st -> block[k - 1] > page_index){
+                    st -> block[k] = st -> block[k - 1];
+                    k--;
                 }
-            }   
+                st -> block[k] = page_index;
+                st -> nblock++;
+                st -> pos_outer++;
+            }
+            st -> pos_inner = 0;
+            st -> ahead_inner = 0;
+        }
 
-            // we have compare one page of table 2 with table 1, release this page
-            if (buffer_pool[page_index_2] -> pin_count != 0){
-               buffer_pool[page_index_2] -> pin_count--;
+        if (st -> page_index_inner == UNUSED){
+            // compared the whole inner table with this block, release all its pages
+            if (st -> pos_inner == st -> inner.npages){
+                for (UINT k = 0; k < st -> nblock; k++){
+                    release_page(st -> block[k]);
+                }
+                st -> nblock = 0;
+                continue;
             }
+            st -> page_index_inner = get_page_with_ring(st -> pids_inner[st -> pos_inner],st -> inner.oid,st -> inner.ntuples_per_page,nattrs_inner,st -> inner.npages,&st -> ring_inner);
+            read_ahead(st -> inner.oid, st -> pids_inner, st -> pos_inner + 1, st -> inner.npages, &st -> ahead_inner);
+            st -> np_inner = 0;
+            st -> k = 0;
+            st -> np_outer = 0;
         }
 
-        // release all pages of table 1
-        for (UINT table_1_index = 0; table_1_index < nslots; table_1_index++){
-            if (buffer_pool[table_1_index] -> pin_count != 0 && buffer_pool[table_1_index] -> oid == oid_1){
-                buffer_pool[table_1_index] -> pin_count--;
+        // compare all tuples of current inner page with pages of the block,
+        // stop when batch is full and continue from the same place next time
+        UINT page_index_inner = st -> page_index_inner;
+        for (; st -> np_inner < buffer_pool[page_index_inner].ntuples; st -> np_inner++){
+            Tuple t_inner = page_tuple(page_index_inner, st -> np_inner);
+            for (; st -> k < st -> nblock; st -> k++){
+                UINT page_index_outer = st -> block[st -> k];
+                for (; st -> np_outer < buffer_pool[page_index_outer].ntuples; st -> np_outer++){
+                    if (batch_full(batch)){
+                        return;
+                    }
+                    Tuple t_outer = page_tuple(page_index_outer, st -> np_outer);
+                    if (t_outer[st -> idx_outer] == t_inner[st -> idx_inner]){
+                        append_joined(batch, t_outer, nattrs_outer, t_inner, nattrs_inner, st -> flag);
+                    }
+                }
+                st -> np_outer = 0;
             }
+            st -> k = 0;
         }
+
+        // we have compared one page of inner table with the block, release this page
+        release_page(page_index_inner);
+        st -> page_index_inner = UNUSED;
+        st -> pos_inner++;
+    }
+}
+
+static void nested_close(Operator* op){
+    Nested_state* st = op -> state;
+    if (st -> page_index_inner != UNUSED){
+        release_page(st -> page_index_inner);
     }
+    for (UINT k = 0; k < st -> nblock; k++){
+        release_page(st -> block[k]);
+    }
+    unreserve_pins(st -> block_size + 1);
+    free(st -> block);
+    free(st -> pids_outer);
+    free(st -> pids_inner);
+    ring_free(&st -> ring_inner);
+}
 
+// first and last page of chunk c of a table, for threads claiming chunks
+static inline UINT64 chunk_end(UINT64 c, UINT64 npages){
+    UINT64 end = (c + 1) * PARALLEL_CHUNK;
+    return end < npages ? end : npages;
+}
 
-    bool check_uncompared = false;
-    for (UINT i = 0; i < nslots; i++){
-        // there are still some pages of table 1 left uncompared in buffer 
-        if (buffer_pool[i] -> oid == oid_1 && buffer_pool[i] -> pin_count != 0){
-            check_uncompared = true;
+// copy the tuples of each chunk of build pages a thread claims into the
+// buffer of the chunk, ordered by partition but otherwise in page order
+static void* partition_build_worker(void* arg){
+    Parallel_hash* ph = arg;
+    const Table_meta* build = &ph -> join -> build;
+    UINT idx = ph -> join -> idx_build;
+    UINT nparts = ph -> nparts;
+    const UINT64* pids = ph -> pids_build;
+    Tuple_buf tuples = {build -> nattrs, 0, 0, NULL};
+    UINT* part = NULL;
+    UINT64 part_capacity = 0;
+    UINT64 ahead = 0;
+
+    while (true){
+        UINT64 c = __atomic_fetch_add(&ph -> next, 1, __ATOMIC_RELAXED);
+        if (c >= ph -> nchunks_build){
+            break;
+        }
+        UINT64 end = chunk_end(c, build -> npages);
+        tuples.ntuples = 0;
+        for (UINT64 pos = c * PARALLEL_CHUNK; pos < end; pos++){
+            UINT page_index = get_requested_page(pids[pos],build -> oid,build -> ntuples_per_page,build -> nattrs,build -> npages);
+            read_ahead(build -> oid, pids, pos + 1, end, &ahead);
+            append_tuples(&tuples, page_tuple(page_index, 0), buffer_pool[page_index].ntuples);
+            release_page(page_index);
+        }
+
+        // count tuples of each partition, then scatter them after the
+        // tuples of the partitions before
+        if (tuples.ntuples > part_capacity){
+            part_capacity = tuples.ntuples;
+            part = realloc(part, sizeof(UINT) * part_capacity);
+        }
+        UINT64* offsets = ph -> offsets + c * (nparts + 1);
+        memset(offsets, 0, sizeof(UINT64) * (nparts + 1));
+        for (UINT64 i = 0; i < tuples.ntuples; i++){
+            part[i] = partition_of(tuples.data[i * build -> nattrs + idx], nparts);
+            offsets[part[i] + 1]++;
+        }
+        for (UINT p = 0; p < nparts; p++){
+            offsets[p + 1] += offsets[p];
+        }
+
+        Tuple_buf* out = &ph -> build_chunks[c];
+        reserve_tuples(out, tuples.ntuples);
+        out -> ntuples = tuples.ntuples;
+        UINT64 fill[nparts];
+        memcpy(fill, offsets, sizeof(UINT64) * nparts);
+        for (UINT64 i = 0; i < tuples.ntuples; i++){
+            memcpy(out -> data + fill[part[i]]++ * build -> nattrs, tuples.data + i * build -> nattrs, sizeof(INT) * build -> nattrs);
         }
     }
-    
-    if (check_uncompared){
-        for (UINT64 pid_index_2 = 0; pid_index_2 < npages_2; pid_index_2++){
-            // get current page id
-            UINT64 pid_2 = pageId_array_2[pid_index_2];
-
-            UINT page_index_2 = get_requested_page(pid_2,oid_2,ntuples_per_page_2,nattrs_2,npages_2);
-            // compare all tuples of current page from table 2
-            for (UINT np_2 = 0; np_2 < buffer_pool[page_index_2] -> ntuples; np_2++){
-                
-                // treaverse buffer pool to find pages of table 1
-                for (UINT table_1_index = 0; table_1_index < nslots; table_1_index++){
-                    // find a page from table 1
-                    if (buffer_pool[table_1_index] -> oid == oid_1){
-                        for (UINT np_1 = 0; np_1 < buffer_pool[table_1_index] -> ntuples; np_1++){
-                            
-                            // find one matching tuple, add to result table
-                            if (buffer_pool[table_1_index] -> tuples[np_1][idx1] == buffer_pool[page_index_2] -> tuples[np_2][idx2] 
-                                && buffer_pool[table_1_index] -> pin_count != 0)
-                            {    
-                                // store each attribute of tuple from table 1 and 2 into temp_table
-                                UINT na = 0;
-
-                                // store the attribute of table 1 first
-                                if (flag == 0){
-                                    for (UINT na_1 = 0; na_1 < nattrs_1; na_1++){
-                                        temp_table[ntuple_ret][na] = buffer_pool[table_1_index] -> tuples[np_1][na_1];
-                                        na++;
-                                    }
-                                    for (UINT na_2 = 0; na_2 < nattrs_2; na_2++){
-                                        temp_table[ntuple_ret][na] = buffer_pool[page_index_2] -> tuples[np_2][na_2];
-                                        na++;
-                                    }
-                                }
-
-                                // store the attribute of table 2 first
-                                if (flag == 1){
-                                    for (UINT na_2 = 0; na_2 < nattrs_2; na_2++){
-                                        temp_table[ntuple_ret][na] = buffer_pool[page_index_2] -> tuples[np_2][na_2];
-                                        na++;
-                                    }
-                                    for (UINT na_1 = 0; na_1 < nattrs_1; na_1++){
-                                        temp_table[ntuple_ret][na] = buffer_pool[table_1_index] -> tuples[np_1][na_1];
-                                        na++;
-                                    }
-                                }
-
-                                ntuple_ret += 1;
-                            }
-                        }
-                    }
-                }
-            }
 
-            // we have compared one page of table 2 with table 1, release this page
-            if (buffer_pool[page_index_2] -> pin_count != 0){
-                buffer_pool[page_index_2] -> pin_count--;
-            }
+    free(tuples.data);
+    free(part);
+    return NULL;
+}
+
+// build the hash table of each partition a thread claims, inserting its
+// tuples chunk by chunk so that the chains of rows are in the same order
+// as in the hash table of a sequential hash join
+static void* build_partition_worker(void* arg){
+    Parallel_hash* ph = arg;
+    const Hash_state* st = ph -> join;
+    UINT nparts = ph -> nparts;
+    UINT64 nkeys = attr_ndv(&st -> build, st -> idx_build) / nparts + 1;
+
+    while (true){
+        UINT64 p = __atomic_fetch_add(&ph -> next, 1, __ATOMIC_RELAXED);
+        if (p >= nparts){
+            break;
+        }
+        UINT64 nrows = 0;
+        for (UINT64 c = 0; c < ph -> nchunks_build; c++){
+            const UINT64* offsets = ph -> offsets + c * (nparts + 1);
+            nrows += offsets[p + 1] - offsets[p];
         }
 
-        // release all pages of table 1
-        for (UINT table_1_index = 0; table_1_index < nslots; table_1_index++){
-            if (buffer_pool[table_1_index] -> pin_count != 0 && buffer_pool[table_1_index] -> oid == oid_1){
-                buffer_pool[table_1_index] -> pin_count--;
+        Hash_table* ht = &ph -> tables[p];
+        ht_init(ht, st -> build.nattrs, st -> idx_build, nrows, nkeys);
+        for (UINT64 c = 0; c < ph -> nchunks_build; c++){
+            const UINT64* offsets = ph -> offsets + c * (nparts + 1);
+            const INT* rows = ph -> build_chunks[c].data;
+            for (UINT64 i = offsets[p]; i < offsets[p + 1]; i++){
+                ht_insert(ht, rows + i * st -> build.nattrs);
             }
         }
     }
+    return NULL;
+}
 
-    // create return table and copy each tuple from temp table to return table
-    _Table* ret_table =  malloc(sizeof(_Table)+ntuple_ret*sizeof(Tuple));
-    ret_table -> nattrs = nattrs_1+nattrs_2;
-    ret_table -> ntuples = ntuple_ret;
-    for (UINT i = 0; i < ntuple_ret; i++){
-        Tuple t = malloc(sizeof(INT)*ret_table->nattrs);
-        // copy each tuple from temporary tuples into return tuple
-        for (UINT attr = 0; attr < nattrs_1+nattrs_2; attr++){
-            INT ret_attr = temp_table[i][attr];
-            t[attr] = ret_attr;
+// join the tuples of each chunk of probe pages a thread claims with the
+// hash tables of all partitions, which are only read now
+static void* probe_partition_worker(void* arg){
+    Parallel_hash* ph = arg;
+    const Hash_state* st = ph -> join;
+    const Table_meta* probe = &st -> probe;
+    UINT64 ahead = 0;
+
+    while (true){
+        UINT64 c = __atomic_fetch_add(&ph -> next, 1, __ATOMIC_RELAXED);
+        if (c >= ph -> nchunks_probe){
+            break;
+        }
+        Tuple_buf* out = &ph -> results[c];
+        UINT64 end = chunk_end(c, probe -> npages);
+        for (UINT64 pos = c * PARALLEL_CHUNK; pos < end; pos++){
+            UINT page_index = get_requested_page(st -> pids_probe[pos],probe -> oid,probe -> ntuples_per_page,probe -> nattrs,probe -> npages);
+            read_ahead(probe -> oid, st -> pids_probe, pos + 1, end, &ahead);
+            for (UINT np = 0; np < buffer_pool[page_index].ntuples; np++){
+                Tuple t = page_tuple(page_index, np);
+                INT key = t[st -> idx_probe];
+                const Hash_table* ht = &ph -> tables[partition_of(key, ph -> nparts)];
+                for (INT64 r = ht_lookup(ht, key); r != -1; r = ht -> next[r]){
+                    append_joined(out, ht_row(ht, r), st -> build.nattrs, t, probe -> nattrs, st -> flag);
+                }
+            }
+            release_page(page_index);
         }
-        ret_table -> tuples[i] = t;
     }
+    return NULL;
+}
 
-    return ret_table;
+// hash join with nworkers threads, pids_build are the page ids of build
+// table, which is partitioned so that the hash table of each partition
+// stays in cache, joined tuples are put in result in the order hash_next
+// returns them
+static void parallel_hash_join(Hash_state* st, UINT nworkers, const UINT64* pids_build){
+    Parallel_hash ph;
+    ph.join = st;
+    ph.pids_build = pids_build;
+
+    // partitions small enough for cache, at least one for each thread
+    UINT64 row_bytes = sizeof(INT) * st -> build.nattrs + sizeof(INT64);
+    UINT64 nparts = (st -> build.ntuples * row_bytes + HASH_PARTITION_BYTES - 1) / HASH_PARTITION_BYTES;
+    if (nparts < nworkers){
+        nparts = nworkers;
+    }
+    if (nparts > MAX_HASH_PARTITIONS){
+        nparts = MAX_HASH_PARTITIONS;
+    }
+    ph.nparts = nparts;
+
+    ph.nchunks_build = (st -> build.npages + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+    ph.build_chunks = malloc(sizeof(Tuple_buf) * ph.nchunks_build);
+    for (UINT64 c = 0; c < ph.nchunks_build; c++){
+        ph.build_chunks[c] = (Tuple_buf){st -> build.nattrs, 0, 0, NULL};
+    }
+    ph.offsets = malloc(sizeof(UINT64) * ph.nchunks_build * (nparts + 1));
+    ph.tables = malloc(sizeof(Hash_table) * nparts);
+    ph.nchunks_probe = (st -> probe.npages + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+    ph.results = malloc(sizeof(Tuple_buf) * ph.nchunks_probe);
+    for (UINT64 c = 0; c < ph.nchunks_probe; c++){
+        ph.results[c] = (Tuple_buf){st -> build.nattrs + st -> probe.nattrs, 0, 0, NULL};
+    }
+
+    // each phase starts when every thread finished the one before
+    ph.next = 0;
+    run_parallel(nworkers, partition_build_worker, &ph);
+    ph.next = 0;
+    run_parallel(nworkers, build_partition_worker, &ph);
+    ph.next = 0;
+    run_parallel(nworkers, probe_partition_worker, &ph);
+
+    gather_chunks(&st -> result, st -> build.nattrs + st -> probe.nattrs, ph.results, ph.nchunks_probe);
+    for (UINT64 c = 0; c < ph.nchunks_build; c++){
+        free(ph.build_chunks[c].data);
+    }
+    for (UINT p = 0; p < nparts; p++){
+        ht_free(&ph.tables[p]);
+    }
+    free(ph.build_chunks);
+    free(ph.offsets);
+    free(ph.tables);
+    free(ph.results);
 }
 
-// use simple hash join 
-static _Table* hash_join(UINT oid_1, 
-                        UINT oid_2,
-                        UINT64 npages_1,
-                        UINT64 npages_2,
-                        UINT ntuples_per_page_1,
-                        UINT ntuples_per_page_2,
-                        UINT nattrs_1,
-                        UINT nattrs_2,
-                        UINT idx1,
-                        UINT idx2,
-                        UINT ntuples_1,
-                        UINT ntuples_2,
-                        INT flag){ 
-
-    // read all page ids of table 1 first
-    UINT64 pageId_array_1[npages_1];
-    get_page_ids(oid_1, npages_1,pageId_array_1);
-
-    UINT64 pageId_array_2[npages_2];
-    get_page_ids(oid_2, npages_2,pageId_array_2);
+// in-memory hash join, used when both tables fit in buffer pool, tuples of
+// the build table are inserted into a hash table in one pass when the
+// operator is opened, then each tuple of the probe table probes it
+static void hash_open(Operator* op){
+    Hash_state* st = op -> state;
+
+    // read all page ids of the build table first
+    UINT64* pageId_array = malloc(sizeof(UINT64) * st -> build.npages);
+    get_page_ids(st -> build.oid, st -> build.npages, pageId_array);
+
+    st -> pids_probe = malloc(sizeof(UINT64) * st -> probe.npages);
+    get_page_ids(st -> probe.oid, st -> probe.npages, st -> pids_probe);
+    st -> page_index = UNUSED;
+
+    // large tables may be joined by several threads at once, the joined
+    // tuples are then returned from result
+    const Table_meta* larger = st -> build.npages > st -> probe.npages ? &st -> build : &st -> probe;
+    UINT nworkers = parallel_workers(larger);
+    st -> parallel = nworkers > 1;
+    st -> next = 0;
+    if (st -> parallel){
+        parallel_hash_join(st, nworkers, pageId_array);
+        free(pageId_array);
+        return;
+    }
 
     // use hash table outside of buffer pool, we only read page into buffer pool
-    UINT ntable = nslots - 2;
-    Tuple* hash_table[ntable];
-
-    // allocate memory for each pointer in hash table
-    for (UINT i = 0; i < ntable; i++){
-        // each slot in hash table can hold ntuples_per_page_1 
-        hash_table[i] = malloc(sizeof(Tuple) * ntuples_per_page_1);
-        
-        // initialize each tuple and set to 0
-        for (UINT np = 0; np < ntuples_per_page_1; np++){
-            hash_table[i][np] = malloc(sizeof(INT)*nattrs_1);
-            for (UINT na = 0; na < nattrs_1; na++){
-                hash_table[i][np][na] = 0;
-            }
+    ht_init(&st -> hash_table, st -> build.nattrs, st -> idx_build, st -> build.ntuples, attr_ndv(&st -> build, st -> idx_build));
+
+    UINT64 ahead = 0;
+    for (UINT64 pid_index = 0; pid_index < st -> build.npages; pid_index++){
+        UINT page_index = get_requested_page(pageId_array[pid_index],st -> build.oid,st -> build.ntuples_per_page,st -> build.nattrs,st -> build.npages);
+        read_ahead(st -> build.oid, pageId_array, pid_index + 1, st -> build.npages, &ahead);
+        for (UINT np = 0; np < buffer_pool[page_index].ntuples; np++){
+            ht_insert(&st -> hash_table, page_tuple(page_index,np));
         }
+        release_page(page_index);
     }
+    free(pageId_array);
 
-    // maximum tuples we can get after join
-    UINT64 max_tuples = ntuples_1*ntuples_2;
-
-    // temporary tuple to store resulting tuples
-    INT temp_table[max_tuples][nattrs_1 + nattrs_2];
-
-    for (UINT i = 0; i < max_tuples; i++){
-        for (UINT j = 0; j < nattrs_1 + nattrs_2; j++){
-            temp_table[i][j] = 0;
-        }
-    }
-
-    // number of tuples to return
-    UINT ntuple_ret = 0;
-
-    // perform hash join, reach tuples of each page from table 1 into hash table
-    for (UINT64 pid_index_1 = 0; pid_index_1 < npages_1; pid_index_1++){
-        // get current page id
-        UINT64 pid_1 = pageId_array_1[pid_index_1];
-
-        // request page from table 1
-        UINT page_index = get_requested_page(pid_1,oid_1,ntuples_per_page_1,nattrs_1,npages_1);
-        
-        // read each tuple from buffer into hash table
-        for (UINT np = 0; np < buffer_pool[page_index] -> ntuples; np++){
-            // we use modular operation to determine which slot 
-            // of hash table to insert tuple
-            UINT hash_index = (buffer_pool[page_index] -> tuples[np][idx1])%ntable;
-            
-            // check whether the slot is full, if not, return the 
-            // available tuple index to insert tuple
-            UINT slot_index = find_next_free_tuple(hash_table,hash_index,ntuples_per_page_1,nattrs_1);
-            
-            // current slot is full or we reach the last page
-            if (slot_index == -1){
-                
-                // check each tuple from table 2
-                for (UINT64 pid_index_2 = 0; pid_index_2 < npages_2; pid_index_2++){
-                    // get current page id
-                    UINT64 pid_2 = pageId_array_2[pid_index_2];
-
-                    // request page from table 2
-                    UINT page_index_2 = get_requested_page(pid_2,oid_2,ntuples_per_page_2,nattrs_2,npages_2);
-
-                    // scan each tuple of table 2 to compare with table 1
-                    for (UINT np_2 = 0; np_2 < buffer_pool[page_index_2] -> ntuples; np_2++){
-                        UINT hash_index_2 = (buffer_pool[page_index_2] -> tuples[np_2][idx2])%ntable;
-                        
-                        // the tuple of table 2 is not in same slot as the tuple of table 1
-                        if (hash_index != hash_index_2){
-                            continue;
-                        }
-
-                        // find each matching tuple and store it into temp_table
-                        for (UINT tp = 0; tp < ntuples_per_page_1; tp++){
-                            if (hash_table[hash_index][tp][idx1] == buffer_pool[page_index_2] -> tuples[np_2][idx2]){
-                                // store each attribute of tuple from table 1 and 2 into temp_table
-                                UINT na = 0;
-                                
-                                // store the attribute of table 1 first, given that the size of table is smaller
-                                if (flag == 0){
-                                    for (UINT na_1 = 0; na_1 < nattrs_1; na_1++){
-                                        temp_table[ntuple_ret][na] = hash_table[hash_index][tp][na_1];
-                                        na++;
-                                    }
-                                    for (UINT na_2 = 0; na_2 < nattrs_2; na_2++){
-                                        temp_table[ntuple_ret][na] = buffer_pool[page_index_2] -> tuples[np_2][na_2];
-                                        na++;
-                                    }
-                                }
-
-                                // store the attribute of table 2 first
-                                if (flag == 1){
-                                    for (UINT na_2 = 0; na_2 < nattrs_2; na_2++){
-                                        temp_table[ntuple_ret][na] = buffer_pool[page_index_2] -> tuples[np_2][na_2];
-                                        na++;
-                                    }
-                                    for (UINT na_1 = 0; na_1 < nattrs_1; na_1++){
-                                        temp_table[ntuple_ret][na] = hash_table[hash_index][tp][na_1];
-                                        na++;
-                                    }
-                                }
-
-                                ntuple_ret += 1;
-                            }
-                        }
-                    }
+    st -> pos = 0;
+    st -> ahead = 0;
+    st -> page_index = UNUSED;
+}
 
-                    // clear all tuples of current slot, reset all attributes to 0
-                    clear_slot(hash_table,hash_index,ntuples_per_page_1,nattrs_1);
+static void hash_next(Operator* op, Tuple_buf* batch){
+    Hash_state* st = op -> state;
+    Hash_table* ht = &st -> hash_table;
 
-                    // release page of table 2, decrease pin count by 1
-                    if (buffer_pool[page_index_2] -> pin_count != 0){
-                        buffer_pool[page_index_2] -> pin_count--;
-                    }
+    if (st -> parallel){
+        next_from_result(&st -> result, &st -> next, batch);
+        return;
+    }
 
-                }
+    while (true){
+        if (st -> page_index == UNUSED){
+            if (st -> pos == st -> probe.npages){
+                return;
             }
-            insert_tuple_into_slot(hash_table,hash_index,slot_index,page_index,np);
+            st -> page_index = get_requested_page(st -> pids_probe[st -> pos],st -> probe.oid,st -> probe.ntuples_per_page,st -> probe.nattrs,st -> probe.npages);
+            st -> pos++;
+            read_ahead(st -> probe.oid, st -> pids_probe, st -> pos, st -> probe.npages, &st -> ahead);
+            st -> np = 0;
+            st -> looked_up = false;
         }
 
-         // release page, decrease pin count by 1
-        if (buffer_pool[page_index] -> pin_count != 0){
-            buffer_pool[page_index] -> pin_count--;
+        // find matching tuples of build table for each tuple of probe table,
+        // a chain interrupted by a full batch is continued next time
+        UINT page_index = st -> page_index;
+        for (; st -> np < buffer_pool[page_index].ntuples; st -> np++){
+            Tuple t = page_tuple(page_index, st -> np);
+            if (!st -> looked_up){
+                st -> r = ht_lookup(ht, t[st -> idx_probe]);
+                st -> looked_up = true;
+            }
+            for (; st -> r != -1; st -> r = ht -> next[st -> r]){
+                if (batch_full(batch)){
+                    return;
+                }
+                append_joined(batch, ht_row(ht, st -> r), st -> build.nattrs, t, st -> probe.nattrs, st -> flag);
+            }
+            st -> looked_up = false;
         }
+
+        release_page(page_index);
+        st -> page_index = UNUSED;
+    }
+}
+
+static void hash_close(Operator* op){
+    Hash_state* st = op -> state;
+    if (st -> page_index != UNUSED){
+        release_page(st -> page_index);
+    }
+    if (st -> parallel){
+        free(st -> result.data);
+    }
+    else{
+        ht_free(&st -> hash_table);
+    }
+    free(st -> pids_probe);
+}
+
+// grace hash join, used when the build table does not fit in buffer pool,
+// both tables are partitioned by the join key into temporary files when the
+// operator is opened, then each partition of the build table is loaded into
+// a hash table and probed by the matching partition of the probe table
+static void grace_open(Operator* op){
+    Grace_state* st = op -> state;
+
+    // one buffer slot reads the input, the others are output pages of partitions,
+    // we want each partition of the build table to fit in nslots - 2 pages,
+    // which are held in a hash table outside buffer pool as in hash join
+    UINT npages_build = nslots > 2 ? nslots - 2 : 1;
+    UINT nparts = (st -> build.npages + npages_build - 1) / npages_build;
+    if (nparts > nslots - 1){
+        nparts = nslots - 1;
+    }
+    if (nparts == 0){
+        nparts = 1;
     }
+    st -> nparts = nparts;
+
+    st -> parts_build = malloc(sizeof(Partition) * nparts);
+    st -> parts_probe = malloc(sizeof(Partition) * nparts);
+    open_partitions(st -> parts_build, nparts);
+    open_partitions(st -> parts_probe, nparts);
+
+    partition_table(st -> parts_build, nparts, st -> build.oid, st -> build.npages, st -> build.ntuples_per_page, st -> build.nattrs, st -> idx_build);
+    partition_table(st -> parts_probe, nparts, st -> probe.oid, st -> probe.npages, st -> probe.ntuples_per_page, st -> probe.nattrs, st -> idx_probe);
+
+    // tuples of build table we hold in memory at a time, a partition larger
+    // than this (skewed keys) is joined chunk by chunk
+    st -> chunk_capacity = (UINT64)npages_build * st -> build.ntuples_per_page;
+    ht_init(&st -> hash_table, st -> build.nattrs, st -> idx_build, st -> chunk_capacity, attr_ndv(&st -> build, st -> idx_build) / nparts + 1);
+
+    // partitions are read back through one buffer slot
+    st -> page_index = get_scratch_slot();
+    st -> page = buffer_pool[st -> page_index].data;
+
+    st -> p = 0;
+    st -> pos_build = 0;
+    st -> chunk_loaded = false;
+    st -> page_loaded = false;
+}
+
+static void grace_next(Operator* op, Tuple_buf* batch){
+    Grace_state* st = op -> state;
+    Hash_table* ht = &st -> hash_table;
+    UINT nattrs_build = st -> build.nattrs;
+    UINT nattrs_probe = st -> probe.nattrs;
+
+    while (st -> p < st -> nparts){
+        Partition* part_build = &st -> parts_build[st -> p];
+        Partition* part_probe = &st -> parts_probe[st -> p];
+
+        // load as many pages of the partition as the chunk holds
+        if (!st -> chunk_loaded){
+            if (st -> pos_build == part_build -> npages){
+                st -> p++;
+                st -> pos_build = 0;
+                continue;
+            }
+            ht_clear(ht);
+            while (st -> pos_build < part_build -> npages && ht -> nrows + st -> build.ntuples_per_page <= st -> chunk_capacity){
+                UINT n = read_partition_page(part_build, st -> pos_build, st -> page);
+                INT* tuples = (INT*)(st -> page + sizeof(UINT64));
+                for (UINT np = 0; np < n; np++){
+                    ht_insert(ht, tuples + (size_t)np * nattrs_build);
+                }
+                st -> pos_build++;
+            }
+            st -> chunk_loaded = true;
+            st -> pos_probe = 0;
+        }
 
+        // probe with the matching partition of probe table
+        if (!st -> page_loaded){
+            if (st -> pos_probe == part_probe -> npages){
+                st -> chunk_loaded = false;
+                continue;
+            }
+            st -> ntuples = read_partition_page(part_probe, st -> pos_probe, st -> page);
+            st -> np = 0;
+            st -> looked_up = false;
+            st -> page_loaded = true;
+        }
 
-    // finally we need to compare each tuple of table 2 with table 1 again
-    // because some tuples of table 1 are still stored in hash table
-    bool check_uncompared = false;
-    for (UINT i = 0; i < ntable; i++){
-        for (UINT np = 0; np < ntuples_per_page_1; np++){
-            for (UINT na = 0; na < nattrs_1; na++){
-                if (hash_table[i][np][na] != 0){
-                    check_uncompared = true;
+        INT* tuples = (INT*)(st -> page + sizeof(UINT64));
+        for (; st -> np < st -> ntuples; st -> np++){
+            INT* t = tuples + (size_t)st -> np * nattrs_probe;
+            if (!st -> looked_up){
+                st -> r = ht_lookup(ht, t[st -> idx_probe]);
+                st -> looked_up = true;
+            }
+            for (; st -> r != -1; st -> r = ht -> next[st -> r]){
+                if (batch_full(batch)){
+                    return;
                 }
+                append_joined(batch, ht_row(ht, st -> r), nattrs_build, t, nattrs_probe, st -> flag);
             }
+            st -> looked_up = false;
         }
+        st -> page_loaded = false;
+        st -> pos_probe++;
+    }
+}
+
+static void grace_close(Operator* op){
+    Grace_state* st = op -> state;
+    release_page(st -> page_index);
+    ht_free(&st -> hash_table);
+    close_partitions(st -> parts_build, st -> nparts);
+    close_partitions(st -> parts_probe, st -> nparts);
+    free(st -> parts_build);
+    free(st -> parts_probe);
+}
+
+// sort-merge join, a table already sorted on its join key is scanned in
+// place, otherwise it is sorted by external merge sort when the operator is
+// opened; tuples of table 1 with the same key are kept in memory and joined
+// with each tuple of table 2 with that key
+static void merge_open(Operator* op){
+    Merge_state* st = op -> state;
+
+    // both tables are sorted before any cursor pins a buffer slot, as
+    // sorting a table pins all of them
+    st -> run_1 = NULL;
+    st -> run_2 = NULL;
+    if (!st -> sorted_1){
+        st -> run_1 = external_sort(st -> table_1.oid, st -> table_1.npages, st -> table_1.ntuples_per_page, st -> table_1.nattrs, st -> idx1);
+    }
+    if (!st -> sorted_2){
+        st -> run_2 = external_sort(st -> table_2.oid, st -> table_2.npages, st -> table_2.ntuples_per_page, st -> table_2.nattrs, st -> idx2);
+    }
+    // each cursor pins one page
+    reserve_pins(2);
+    if (st -> sorted_1){
+        open_table_cursor(&st -> c1, st -> table_1.oid, st -> table_1.npages, st -> table_1.ntuples_per_page, st -> table_1.nattrs);
+    }
+    else{
+        open_run_cursor(&st -> c1, st -> run_1, st -> table_1.nattrs);
+    }
+    if (st -> sorted_2){
+        open_table_cursor(&st -> c2, st -> table_2.oid, st -> table_2.npages, st -> table_2.ntuples_per_page, st -> table_2.nattrs);
     }
+    else{
+        open_run_cursor(&st -> c2, st -> run_2, st -> table_2.nattrs);
+    }
+
+    // tuples of table 1 sharing current key
+    st -> group.nattrs = st -> table_1.nattrs;
+    st -> group.ntuples = 0;
+    st -> group.capacity = 0;
+    st -> group.data = NULL;
+    st -> in_group = false;
+}
 
-    if (check_uncompared) {
-        for (UINT64 s = 0; s < npages_2; s++){
-            // get current page id
-            UINT64 pid_2 = pageId_array_2[s];
-
-            // page index of current page in buffer pool
-            UINT page_index_2 = get_requested_page(pid_2,oid_2,ntuples_per_page_2,nattrs_2,npages_2);
-
-            // scan each tuple of table 2 to compare with table 1
-            for (UINT np_2 = 0; np_2 < buffer_pool[page_index_2] -> ntuples; np_2++){
-                UINT hash_index = (buffer_pool[page_index_2] -> tuples[np_2][idx2])%ntable;
-                
-                // find each matching tuple and store it into temp_table
-                for (UINT i = 0; i < ntuples_per_page_1; i++){
-
-                    if (hash_table[hash_index][i][idx1] == buffer_pool[page_index_2] -> tuples[np_2][idx2]){
-                        // store each attribute of tuple from table 1 and 2 into temp_table
-                        UINT na = 0;
-                        
-                        // store the attribute of table 1 first, given that the size of table is smaller
-                        if (flag == 0){
-                            for (UINT na_1 = 0; na_1 < nattrs_1; na_1++){
-                                temp_table[ntuple_ret][na] = hash_table[hash_index][i][na_1];
-                                na++;
-                            }
-                            for (UINT na_2 = 0; na_2 < nattrs_2; na_2++){
-                                temp_table[ntuple_ret][na] = buffer_pool[page_index_2] -> tuples[np_2][na_2];
-                                na++;
-                            }
-                        }
-
-                        // store the attribute of table 2 first
-                        if (flag == 1){
-                            for (UINT na_2 = 0; na_2 < nattrs_2; na_2++){
-                                temp_table[ntuple_ret][na] = buffer_pool[page_index_2] -> tuples[np_2][na_2];
-                                na++;
-                            }
-                            for (UINT na_1 = 0; na_1 < nattrs_1; na_1++){
-
-                                temp_table[ntuple_ret][na] = hash_table[hash_index][i][na_1];
-                                na++;
-                            }
-                        }
-
-                        ntuple_ret += 1;
+static void merge_next(Operator* op, Tuple_buf* batch){
+    Merge_state* st = op -> state;
+    UINT nattrs_1 = st -> table_1.nattrs;
+    UINT nattrs_2 = st -> table_2.nattrs;
+
+    while (true){
+        // join the group with each tuple of table 2 with the same key
+        if (st -> in_group){
+            INT* t2 = cursor_tuple(&st -> c2);
+            while (t2 != NULL && t2[st -> idx2] == st -> key){
+                for (; st -> g < st -> group.ntuples; st -> g++){
+                    if (batch_full(batch)){
+                        return;
                     }
+                    append_joined(batch, st -> group.data + st -> g * nattrs_1, nattrs_1, t2, nattrs_2, 0);
                 }
+                st -> g = 0;
+                cursor_advance(&st -> c2);
+                t2 = cursor_tuple(&st -> c2);
             }
+            st -> in_group = false;
+        }
 
-            // release page, decrease pin count by 1
-            if (buffer_pool[page_index_2] -> pin_count != 0){
-                buffer_pool[page_index_2] -> pin_count--;
-            }
+        INT* t1 = cursor_tuple(&st -> c1);
+        INT* t2 = cursor_tuple(&st -> c2);
+        if (t1 == NULL || t2 == NULL){
+            return;
         }
+        if (t1[st -> idx1] < t2[st -> idx2]){
+            cursor_advance(&st -> c1);
+            continue;
+        }
+        if (t1[st -> idx1] > t2[st -> idx2]){
+            cursor_advance(&st -> c2);
+            continue;
+        }
+
+        // collect tuples of table 1 with this key
+        st -> key = t1[st -> idx1];
+        st -> group.ntuples = 0;
+        while (t1 != NULL && t1[st -> idx1] == st -> key){
+            append_joined(&st -> group, t1, nattrs_1, NULL, 0, 0);
+            cursor_advance(&st -> c1);
+            t1 = cursor_tuple(&st -> c1);
+        }
+        st -> in_group = true;
+        st -> g = 0;
+    }
+}
+
+static void merge_close(Operator* op){
+    Merge_state* st = op -> state;
+    close_cursor(&st -> c1);
+    close_cursor(&st -> c2);
+    unreserve_pins(2);
+    if (st -> run_1 != NULL){
+        close_partitions(st -> run_1, 1);
+        free(st -> run_1);
+    }
+    if (st -> run_2 != NULL){
+        close_partitions(st -> run_2, 1);
+        free(st -> run_2);
+    }
+    free(st -> group.data);
+}
+
+// index nested loop join, the outer table is read once, its tuples probe
+// the index of the inner table in batches sorted by key so consecutive
+// probes find index pages in buffer pool, and the inner tuples found are
+// read page by page in file order
+static void index_join_open(Operator* op){
+    Index_join_state* st = op -> state;
+
+    st -> pids_outer = malloc(sizeof(UINT64) * st -> outer.npages);
+    get_page_ids(st -> outer.oid, st -> outer.npages, st -> pids_outer);
+    st -> pids_inner = malloc(sizeof(UINT64) * st -> inner.npages);
+    get_page_ids(st -> inner.oid, st -> inner.npages, st -> pids_inner);
+    st -> pos_outer = 0;
+
+    // a batch ends after the outer page that fills it
+    st -> probes = malloc(sizeof(INT) * (PROBE_BATCH + st -> outer.ntuples_per_page) * st -> outer.nattrs);
+    st -> nprobes = 0;
+    st -> matches = NULL;
+    st -> nmatches = 0;
+    st -> match_capacity = 0;
+    st -> m = 0;
+    st -> page_index = UNUSED;
+}
+
+// read the next batch of outer tuples and find their inner tuples
+static void index_join_probe(Index_join_state* st){
+    UINT nattrs_outer = st -> outer.nattrs;
+
+    // copy outer tuples, their pages are released right away
+    st -> nprobes = 0;
+    while (st -> nprobes < PROBE_BATCH && st -> pos_outer < st -> outer.npages){
+        UINT page_index = get_requested_page(st -> pids_outer[st -> pos_outer],st -> outer.oid,st -> outer.ntuples_per_page,nattrs_outer,st -> outer.npages);
+        UINT ntuples = buffer_pool[page_index].ntuples;
+        memcpy(st -> probes + (size_t)st -> nprobes * nattrs_outer, page_tuple(page_index, 0), sizeof(INT) * nattrs_outer * ntuples);
+        st -> nprobes += ntuples;
+        release_page(page_index);
+        st -> pos_outer++;
+    }
+
+    // probe in key order, each key once
+    Sort_item* items = malloc(sizeof(Sort_item) * (st -> nprobes + 1));
+    for (UINT i = 0; i < st -> nprobes; i++){
+        items[i].key = st -> probes[(size_t)i * nattrs_outer + st -> idx_outer];
+        items[i].row = i;
     }
+    qsort(items, st -> nprobes, sizeof(Sort_item), cmp_sort_item);
+
+    st -> nmatches = 0;
+    UINT i = 0;
+    while (i < st -> nprobes){
+        UINT j = i;
+        while (j < st -> nprobes && items[j].key == items[i].key){
+            j++;
+        }
 
-    // create return table and copy each tuple from temp table to return table
-    _Table* ret_table =  malloc(sizeof(_Table)+ntuple_ret*sizeof(Tuple));
-    ret_table -> nattrs = nattrs_1+nattrs_2;
-    ret_table -> ntuples = ntuple_ret;
-    for (UINT i = 0; i < ntuple_ret; i++){
-        Tuple t = malloc(sizeof(INT)*ret_table->nattrs);
-        // copy each tuple from temporary tuples into return tuple
-        for (UINT attr = 0; attr < nattrs_1+nattrs_2; attr++){
-            INT ret_attr = temp_table[i][attr];
-            t[attr] = ret_attr;
+        UINT64 nrids;
+        Leaf_entry* rids = index_lookup(&st -> index, items[i].key, items[i].key, &nrids);
+        for (UINT64 r = 0; r < nrids; r++){
+            for (UINT k = i; k < j; k++){
+                if (st -> nmatches == st -> match_capacity){
+                    st -> match_capacity = st -> match_capacity == 0 ? PROBE_BATCH : st -> match_capacity * 2;
+                    st -> matches = realloc(st -> matches, sizeof(Probe_match) * st -> match_capacity);
+                }
+                Probe_match* match = &st -> matches[st -> nmatches++];
+                match -> outer = items[k].row;
+                match -> pos = rids[r].pos;
+                match -> slot = rids[r].slot;
+            }
         }
-        ret_table -> tuples[i] = t;
+        free(rids);
+        i = j;
     }
+    free(items);
+
+    // each inner page is read once per batch
+    qsort(st -> matches, st -> nmatches, sizeof(Probe_match), cmp_rid_match);
+    st -> m = 0;
+}
+
+static void index_join_next(Operator* op, Tuple_buf* batch){
+    Index_join_state* st = op -> state;
+    UINT nattrs_outer = st -> outer.nattrs;
+    UINT nattrs_inner = st -> inner.nattrs;
+
+    while (!batch_full(batch)){
+        if (st -> m == st -> nmatches){
+            if (st -> pos_outer == st -> outer.npages){
+                return;
+            }
+            index_join_probe(st);
+            continue;
+        }
 
-    // free hash table
-    for (UINT i = 0; i < ntable; i++){
-        // free each tuple of i-th slot
-        for (UINT np = 0; np < ntuples_per_page_1; np++){
-            free(hash_table[i][np]);
+        // join matches on the same inner page, stop when batch is full
+        // and continue from the same match next time
+        UINT pos = st -> matches[st -> m].pos;
+        if (st -> page_index == UNUSED){
+            st -> page_index = get_requested_page(st -> pids_inner[pos],st -> inner.oid,st -> inner.ntuples_per_page,nattrs_inner,st -> inner.npages);
+        }
+        for (; st -> m < st -> nmatches && st -> matches[st -> m].pos == pos && !batch_full(batch); st -> m++){
+            Probe_match* match = &st -> matches[st -> m];
+            INT* t_outer = st -> probes + (size_t)match -> outer * nattrs_outer;
+            append_joined(batch, t_outer, nattrs_outer, page_tuple(st -> page_index, match -> slot), nattrs_inner, st -> flag);
+        }
+        if (st -> m == st -> nmatches || st -> matches[st -> m].pos != pos){
+            release_page(st -> page_index);
+            st -> page_index = UNUSED;
         }
-        // free i-th slot 
-        free(hash_table[i]);
     }
+}
 
-    return ret_table;
+static void index_join_close(Operator* op){
+    Index_join_state* st = op -> state;
+    if (st -> page_index != UNUSED){
+        release_page(st -> page_index);
+    }
+    free(st -> pids_outer);
+    free(st -> pids_inner);
+    free(st -> probes);
+    free(st -> matches);
 }
 
-_Table* join(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name){ 
-    printf("join() is invoked.\n");
-    
-    Table_meta table_1 = get_table_meta(table1_name);
+// operator of nested loop join or hash join, flag tells whether table 1
+// (flag = 0) or table 2 (flag = 1) is the outer or build table, the
+// attributes of table 1 always come first in the result
+static Operator* nested_op(const Table_meta* outer, UINT idx_outer, const Table_meta* inner, UINT idx_inner, INT flag){
+    Nested_state* st = malloc(sizeof(Nested_state));
+    st -> outer = *outer;
+    st -> inner = *inner;
+    st -> idx_outer = idx_outer;
+    st -> idx_inner = idx_inner;
+    st -> flag = flag;
+    return new_operator(outer -> nattrs + inner -> nattrs, nested_open, nested_next, nested_close, st);
+}
 
-    // get meta data of table 1 
-    UINT oid_1 = table_1.oid;
-    UINT nattrs_1  = table_1.nattrs;
-    UINT ntuples_1 = table_1.ntuples;
-    INT ntuples_per_page_1 = table_1.ntuples_per_page;
-    UINT64 npages_1 =  table_1.npages;
-    /*==============================================================================*/
+static Operator* hash_op(const Table_meta* build, UINT idx_build, const Table_meta* probe, UINT idx_probe, INT flag){
+    Hash_state* st = malloc(sizeof(Hash_state));
+    st -> build = *build;
+    st -> probe = *probe;
+    st -> idx_build = idx_build;
+    st -> idx_probe = idx_probe;
+    st -> flag = flag;
+    return new_operator(build -> nattrs + probe -> nattrs, hash_open, hash_next, hash_close, st);
+}
 
-    Table_meta table_2 = get_table_meta(table2_name);
+static Operator* grace_op(const Table_meta* build, UINT idx_build, const Table_meta* probe, UINT idx_probe, INT flag){
+    Grace_state* st = malloc(sizeof(Grace_state));
+    st -> build = *build;
+    st -> probe = *probe;
+    st -> idx_build = idx_build;
+    st -> idx_probe = idx_probe;
+    st -> flag = flag;
+    return new_operator(build -> nattrs + probe -> nattrs, grace_open, grace_next, grace_close, st);
+}
 
-    // get meta data of table 1 
-    UINT oid_2 = table_2.oid;
-    UINT nattrs_2  = table_2.nattrs;
-    UINT ntuples_2 = table_2.ntuples;
-    INT ntuples_per_page_2 = table_2.ntuples_per_page;
-    UINT64 npages_2 =  table_2.npages;
-    
-    // get number of buffer slots
-    Conf* cf = get_conf();
-    UINT buf_slots = cf->buf_slots;
+static Operator* merge_op(const Table_meta* table_1, UINT idx1, bool sorted_1, const Table_meta* table_2, UINT idx2, bool sorted_2){
+    Merge_state* st = malloc(sizeof(Merge_state));
+    st -> table_1 = *table_1;
+    st -> table_2 = *table_2;
+    st -> idx1 = idx1;
+    st -> idx2 = idx2;
+    st -> sorted_1 = sorted_1;
+    st -> sorted_2 = sorted_2;
+    return new_operator(table_1 -> nattrs + table_2 -> nattrs, merge_open, merge_next, merge_close, st);
+}
+
+static Operator* index_join_op(const Table_meta* outer, UINT idx_outer, const Table_meta* inner, UINT idx_inner, const Index* index, INT flag){
+    Index_join_state* st = malloc(sizeof(Index_join_state));
+    st -> outer = *outer;
+    st -> inner = *inner;
+    st -> idx_outer = idx_outer;
+    st -> idx_inner = idx_inner;
+    st -> index = *index;
+    st -> flag = flag;
+    return new_operator(outer -> nattrs + inner -> nattrs, index_join_open, index_join_next, index_join_close, st);
+}
+
+// estimated number of tuples of an equi-join, every key of the table with
+// fewer distinct keys is assumed to match a key of the other one
+static UINT64 join_size(const Table_meta* table_1, UINT idx1, const Table_meta* table_2, UINT idx2){
+    const Attr_stats* stats_1 = attr_stats(table_1, idx1);
+    const Attr_stats* stats_2 = attr_stats(table_2, idx2);
+    if (stats_1 != NULL && stats_2 != NULL && (stats_1 -> max < stats_2 -> min || stats_2 -> max < stats_1 -> min)){
+        return 0;
+    }
+    UINT64 ndv_1 = attr_ndv(table_1, idx1);
+    UINT64 ndv_2 = attr_ndv(table_2, idx2);
+    UINT64 ndv = ndv_1 > ndv_2 ? ndv_1 : ndv_2;
+    return (UINT64)((double)table_1 -> ntuples * table_2 -> ntuples / ndv + 0.5);
+}
+
+// name of each join algorithm, for reporting the plan
+static const char* join_method_names[NJOIN_METHODS] = {
+    "in-memory hash join", "block nested loop join", "grace hash join", "sort-merge join", "index nested loop join"
+};
+
+// keep the cheaper of best and the given plan, on a tie the plan found
+// first is kept, so plans are considered from the cheapest to run on cpu
+static void consider_plan(Join_plan* best, UINT method, INT flag, UINT64 cost){
+    if (cost < best -> cost){
+        best -> method = method;
+        best -> flag = flag;
+        best -> cost = cost;
+    }
+}
 
-    // compare and choose proper join method
+// estimate page I/O of each join algorithm on both tables and pick the
+// cheapest, infeasible algorithms are skipped
+static Join_plan plan_join(const Table_meta* table_1, UINT idx1, const Table_meta* table_2, UINT idx2){
+    UINT64 npages_1 = table_1 -> npages;
+    UINT64 npages_2 = table_2 -> npages;
     UINT64 total_pages = npages_1 + npages_2;
-    if (buf_slots < total_pages){
-        if (npages_1 < npages_2){
-            // table 1 is used for outer relation
-            return nested_for_loop_join(oid_1,oid_2,npages_1,npages_2,ntuples_per_page_1,ntuples_per_page_2,nattrs_1,nattrs_2,idx1,idx2,ntuples_1,ntuples_2,0);
-        }
-        else{
-            // table 2 is used for outer relation
-            return nested_for_loop_join(oid_2,oid_1,npages_2,npages_1,ntuples_per_page_2,ntuples_per_page_1,nattrs_2,nattrs_1,idx2,idx1,ntuples_2,ntuples_1,1);     
-        }
+
+    // the smaller table is the outer or build side, table 2 on a tie
+    INT flag_smaller = npages_1 < npages_2 ? 0 : 1;
+    UINT64 npages_outer = flag_smaller == 0 ? npages_1 : npages_2;
+    UINT64 npages_inner = flag_smaller == 0 ? npages_2 : npages_1;
+
+    Join_plan best = {JOIN_NESTED, flag_smaller, UINT64_MAX};
+
+    // in-memory hash join reads each table once, the hash table of the
+    // build side takes as much memory as the whole buffer pool minus the
+    // page for reading tuples
+    if (nslots >= total_pages){
+        consider_plan(&best, JOIN_HASH, flag_smaller, total_pages);
     }
-    else{
-        if (npages_1 < npages_2){
-            // store tuples of table 1 into hash table
-            return hash_join(oid_1,oid_2,npages_1,npages_2,ntuples_per_page_1,ntuples_per_page_2,nattrs_1,nattrs_2,idx1,idx2,ntuples_1,ntuples_2,0);
-        }
-        else{
-            // store tuples of table 2 into hash table
-            return hash_join(oid_2,oid_1,npages_2,npages_1,ntuples_per_page_2,ntuples_per_page_1,nattrs_2,nattrs_1,idx2,idx1,ntuples_2,ntuples_1,1);     
+
+    // block nested loop join reads the outer table once and the inner
+    // table once per nslots - 1 pages of outer table
+    UINT64 nblocks = nslots > 1 ? (npages_outer + nslots - 2) / (nslots - 1) : npages_outer;
+    consider_plan(&best, JOIN_NESTED, flag_smaller, npages_outer + nblocks * npages_inner);
+
+    if (nslots >= 3){
+        // grace hash join reads both tables, writes the partitions and
+        // reads them back
+        consider_plan(&best, JOIN_GRACE, flag_smaller, 3 * total_pages);
+
+        // sort-merge join is cheap when a table is already sorted on its join key
+        bool sorted_1 = idx1 < 64 && ((table_1 -> sorted_attrs >> idx1) & 1);
+        bool sorted_2 = idx2 < 64 && ((table_2 -> sorted_attrs >> idx2) & 1);
+        consider_plan(&best, JOIN_MERGE, 0, sort_merge_cost(npages_1, sorted_1) + sort_merge_cost(npages_2, sorted_2));
+    }
+
+    // an index on the join attribute of one table lets the other table
+    // probe it instead of reading the whole indexed table
+    const Index* index_2 = find_index(table_2 -> oid, idx2);
+    if (index_2 != NULL){
+        consider_plan(&best, JOIN_INDEX, 0, index_join_cost(table_1, table_2, index_2));
+    }
+    const Index* index_1 = find_index(table_1 -> oid, idx1);
+    if (index_1 != NULL){
+        consider_plan(&best, JOIN_INDEX, 1, index_join_cost(table_2, table_1, index_1));
+    }
+
+    return best;
+}
+
+// join as an operator, the join method is chosen here and the work is
+// done when the operator is opened and read
+Operator* join_op(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name){
+    printf("join() is invoked.\n");
+
+    Table_meta table_1 = get_table_meta(table1_name);
+    Table_meta table_2 = get_table_meta(table2_name);
+
+    // the outer, build or probing side is table 1 if flag is 0
+    Join_plan plan = plan_join(&table_1, idx1, &table_2, idx2);
+    printf("Join plan: %s, %s first, estimated %lu page I/O.\n",
+           join_method_names[plan.method], plan.flag == 0 ? table1_name : table2_name, plan.cost);
+
+    const Table_meta* first = plan.flag == 0 ? &table_1 : &table_2;
+    const Table_meta* second = plan.flag == 0 ? &table_2 : &table_1;
+    UINT idx_first = plan.flag == 0 ? idx1 : idx2;
+    UINT idx_second = plan.flag == 0 ? idx2 : idx1;
+
+    Operator* op;
+    switch (plan.method){
+        case JOIN_HASH:
+            op = hash_op(first,idx_first,second,idx_second,plan.flag);
+            break;
+        case JOIN_GRACE:
+            op = grace_op(first,idx_first,second,idx_second,plan.flag);
+            break;
+        case JOIN_MERGE:{
+            bool sorted_1 = idx1 < 64 && ((table_1.sorted_attrs >> idx1) & 1);
+            bool sorted_2 = idx2 < 64 && ((table_2.sorted_attrs >> idx2) & 1);
+            op = merge_op(&table_1,idx1,sorted_1,&table_2,idx2,sorted_2);
+            break;
         }
+        case JOIN_INDEX:
+            op = index_join_op(first,idx_first,second,idx_second,find_index(second -> oid, idx_second),plan.flag);
+            break;
+        default:
+            op = nested_op(first,idx_first,second,idx_second,plan.flag);
+            break;
     }
-}
\ No newline at end of file
+    op -> est_ntuples = join_size(&table_1, idx1, &table_2, idx2);
+    return op;
+}
+
+_Table* join(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name){
+    return op_materialize(join_op(idx1, table1_name, idx2, table2_name));
+}
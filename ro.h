@@ -1,6 +1,12 @@
 #ifndef RO_H
 #define RO_H
+#include <stdbool.h>
+#include <pthread.h>
 #include "db.h"
+#include "filter.h"
+#include "smgr.h"
+#include "replace.h"
+#include "prefetch.h"
 
 // -1 to represent unused file slot in file pointer table
 // and the whether the buffer slot is stored with pages we read from table
@@ -10,8 +16,10 @@
 #define INT64 int64_t
 
 // create an page with usage count for buffer management
-// each time we read one page into buffer slot
+// each time we read one page into buffer slot, the page is kept as
+// its on-disk image and tuples are addressed by offset
 typedef struct Page{
+    INT flag;               // -1(UNUSED) if no page is stored in the slot, otherwise 1
     UINT64 pid;             // index of current page in the table,
                             // page index of each file always start from 0
 
@@ -21,24 +29,370 @@ typedef struct Page{
     UINT ntuples;           // current number of tuples stored in page
     UINT pin_count;         // pin count for clock sweep replacement
     UINT usage;             // usage count for clock sweep replacement
+                            // both are only changed atomically, see get_page_with_ring
 
-    Tuple tuples[];
+    INT8* data;             // page image in buffer slab or in the mapping of its file,
+                            // page id followed by tuples
+    pthread_mutex_t content_latch;  // held by the thread writing the page image into the slot
+    UINT io_in_progress;    // 1 while the page is being read, others wait on content_latch
 }Page;
 
+// number of locks of buffer mapping table, like NUM_BUFFER_PARTITIONS of
+// PostgreSQL, threads looking up pages of different partitions never wait
+// for each other
+#define NUM_BUF_PARTITIONS 16
+
+// entry of buffer mapping table, entry i is the page stored in buffer
+// slot i, entries whose pages hash to the same bucket are chained
+typedef struct Buf_tag{
+    UINT64 pid;             // page id
+    UINT oid;               // table of the page
+    INT next;               // next entry of the bucket, -1(UNUSED) at the end
+}Buf_tag;
+
 typedef struct File{
     INT flag;               // -1(UNUSED) if the slot in file pointer table is not used, otherwise 1
     UINT oid;               // oid of the opened file 
-    FILE* file_opened;      //  file descriptor
+    Smgr_file file;         // the opened file, read through storage manager
+    UINT nreaders;          // pages being read from the file, it is not closed until 0
 }File;
 
+// one entry of page directory, position of the page in its file
+typedef struct Page_pos{
+    UINT64 pid;
+    UINT64 pos;
+}Page_pos;
+
+// page directory of a table, built once when the table is first opened
+// so that a buffer miss can seek straight to the page it wants
+typedef struct Page_dir{
+    UINT oid;               // oid of the table
+    UINT64 npages;          // number of pages in the file
+    UINT64 ntuples;         // number of tuples in the table, 0 for an index
+    UINT64* pids;           // page ids in file order
+    Page_pos* sorted;       // entries sorted by page id, for binary search
+}Page_dir;
+
+// a partition of a relation spilled to a temporary file by hash join,
+// stored as pages each starting with the number of tuples in it
+typedef struct Partition{
+    FILE* fp;               // temporary file under the database folder
+    INT8* page;             // output page being filled, NULL once written
+    UINT ntuples;           // number of tuples in output page
+    UINT64 npages;          // number of pages written to the file
+}Partition;
+
+// growable buffer of result tuples, stored one tuple after another
+typedef struct Tuple_buf{
+    UINT nattrs;
+    UINT64 ntuples;
+    UINT64 capacity;
+    INT* data;
+}Tuple_buf;
+
+// in-memory hash table of hash join, an open addressing table from join key
+// to the chain of rows with that key, rows are referenced by their index
+// in the row store and whether a slot is used is kept in a separate bitmap
+typedef struct Hash_table{
+    UINT nattrs;            // number of attributes of each row
+    UINT idx;               // index of the join key
+    UINT64 nrows;           // number of rows stored
+    UINT64 row_capacity;    // number of rows the row store can hold
+    INT* rows;              // row store, one row after another
+    INT64* next;            // next row with the same key, -1 at the end of chain
+    UINT64 nslots;          // number of slots, a power of 2
+    UINT64 nkeys;           // number of distinct keys, i.e. used slots
+    INT* keys;              // key of each slot
+    INT64* first;           // first row in the chain of each slot
+    UINT64* occupied;       // bitmap of used slots
+}Hash_table;
+
+// cursor over tuples in order of a sort key, either a sorted run in a
+// temporary file or a table already sorted on the key, whose pages are
+// read through buffer pool
+typedef struct Run_cursor{
+    Partition* run;         // sorted run, NULL if we scan a table
+    UINT oid;               // table to scan if run is NULL
+    UINT ntuples_per_page;
+    UINT64* pids;           // page ids of the table in file order
+    UINT nattrs;
+    UINT64 npages;          // number of pages of the run or table
+    UINT64 pos;             // next page to read
+    INT8* page;             // current page of run, in the buffer slot of page_index
+    INT page_index;         // buffer slot of current page of table or of run, UNUSED if none
+    UINT ntuples;           // tuples in current page
+    UINT i;                 // current tuple in current page
+}Run_cursor;
+
+// a page of a B+-tree index holds one node, the node header follows the
+// page id and is followed by the entries of the node
+typedef struct Node_header{
+    UINT is_leaf;
+    UINT nentries;
+    INT next;               // next leaf, UNUSED for the last leaf and inner nodes
+}Node_header;
+
+// entry of a leaf, a key and where the tuple having it is stored
+typedef struct Leaf_entry{
+    INT key;
+    UINT pos;               // position of the page in the table file
+    UINT slot;              // tuple in the page
+}Leaf_entry;
+
+// entry of an inner node, a child and the smallest key under it
+typedef struct Inner_entry{
+    INT key;
+    UINT child;
+}Inner_entry;
+
 typedef struct Table_meta{
     UINT oid;
     UINT nattrs;
     UINT ntuples;
     INT ntuples_per_page;
     UINT64 npages;
+    UINT64 sorted_attrs;    // bit i is set if attribute i is stored in order
+    const Attr_stats* stats;    // statistics of each attribute, NULL if there are none
 }Table_meta;
 
+// join algorithms the planner chooses from
+#define JOIN_HASH 0         // in-memory hash join
+#define JOIN_NESTED 1       // block nested loop join
+#define JOIN_GRACE 2        // grace hash join
+#define JOIN_MERGE 3        // sort-merge join
+#define JOIN_INDEX 4        // index nested loop join
+#define NJOIN_METHODS 5
+
+// a join algorithm and its estimated page I/O
+typedef struct Join_plan{
+    UINT method;            // one of JOIN_*
+    INT flag;               // 1 if table 2 is the outer, build or probing side
+    UINT64 cost;            // pages read and written
+}Join_plan;
+
+// maximum number of tuples an operator returns for each call of op_next
+#define BATCH_SIZE 1024
+
+// most batches of result reserved up front from the estimated number of
+// tuples of an operator, a bad estimate never allocates much more than
+// the result, which grows as it is read
+#define MAX_RESERVED_BATCHES 8
+
+// number of outer tuples index nested loop join probes the index with at
+// a time, the probes of a batch are sorted by key
+#define PROBE_BATCH 4096
+
+// private ring of buffer slots a large sequential scan reads its pages
+// into, the scan reuses its own slots instead of evicting pages other
+// queries may still want, like BufferAccessStrategy of PostgreSQL
+typedef struct Ring{
+    UINT size;              // number of slots, 0 if the scan uses the whole pool
+    INT* slots;             // slot used at each position, UNUSED if none yet
+    UINT pos;               // next position to reuse
+}Ring;
+
+// pull based relational operator, tuples are returned batch by batch so
+// the result never has to be held in memory all at once
+typedef struct Operator Operator;
+struct Operator{
+    UINT nattrs;                                    // number of attributes of each result tuple
+    void (*open)(Operator* op);                     // prepare the operator, e.g. build hash table
+    void (*next)(Operator* op, Tuple_buf* batch);   // add at most BATCH_SIZE tuples to batch
+    void (*close)(Operator* op);                    // release pages and memory held by state
+    void* state;                                    // state of the operator, see below
+    UINT64 est_ntuples;                             // estimated number of result tuples, 0 if unknown
+};
+
+// state of selection, a scan over the pages of one table
+typedef struct Scan_state{
+    Table_meta table;
+    Condition cond;         // the selection condition
+    Filter filter;          // evaluation state of cond
+    UINT64* pids;           // page ids of the table
+    UINT64 pos;             // next page to read
+    INT page_index;         // buffer slot of current page, UNUSED if none
+    UINT* sel_vec;          // indices of matching tuples in current page
+    UINT nsel;              // number of matching tuples in current page
+    UINT i;                 // next entry of sel_vec
+    Ring ring;              // slots the scan reads pages into
+    UINT64 ahead;           // next page to read ahead
+    bool parallel;          // whether result was filled by a parallel scan when opened
+    Tuple_buf result;       // tuples found by the parallel scan
+    UINT64 r;               // next tuple of result to return
+}Scan_state;
+
+// pages a thread of a parallel scan claims at a time, small enough that
+// threads stay busy when matching tuples are not spread evenly
+#define PARALLEL_CHUNK 8
+
+// most threads of a parallel scan
+#define MAX_PARALLEL_WORKERS 64
+
+// shared state of a parallel scan, each thread claims the next chunk of
+// pages from a shared cursor and filters it into the buffer of the chunk,
+// the buffers are concatenated in page order when all chunks are done
+typedef struct Parallel_scan{
+    const Scan_state* scan; // table, condition and page ids
+    UINT64 next_chunk;      // first chunk nobody claimed yet, taken atomically
+    UINT64 nchunks;
+    Tuple_buf* chunks;      // tuples found in each chunk
+}Parallel_scan;
+
+// state of selection answered by an index, only the pages holding tuples
+// the index points to are read, in file order
+typedef struct Index_state{
+    Table_meta table;
+    Condition cond;         // the selection condition
+    Filter filter;          // evaluation state of cond
+    Index index;            // the index used
+    UINT key_pred;          // predicate of cond answered by the index
+    UINT64* pids;           // page ids of the table
+    Leaf_entry* rids;       // entries selected by the index, sorted by position
+    UINT64 nrids;
+    UINT64 r;               // next entry of rids
+    INT page_index;         // buffer slot of current page, UNUSED if none
+    UINT* sel_vec;          // indices of matching tuples in current page
+    UINT nsel;              // number of matching tuples in current page
+    UINT i;                 // next entry of sel_vec
+}Index_state;
+
+// state of block nested loop join
+typedef struct Nested_state{
+    Table_meta outer;
+    Table_meta inner;
+    UINT idx_outer;
+    UINT idx_inner;
+    INT flag;               // 1 if outer table is table 2 of the join
+    UINT64* pids_outer;
+    UINT64* pids_inner;
+    UINT* block;            // buffer slots of outer pages compared at a time
+    UINT block_size;
+    UINT nblock;            // number of outer pages in the block, 0 if none
+    UINT64 pos_outer;       // next outer page to read
+    UINT64 pos_inner;       // next inner page to read
+    INT page_index_inner;   // buffer slot of current inner page, UNUSED if none
+    Ring ring_inner;        // slots the scans of inner table read pages into
+    UINT64 ahead_inner;     // next inner page to read ahead
+    UINT np_inner;          // current tuple of inner page
+    UINT k;                 // current page of the block
+    UINT np_outer;          // current tuple of the outer page
+}Nested_state;
+
+// an inner tuple found by probing an index, joined with an outer tuple
+typedef struct Probe_match{
+    UINT outer;             // outer tuple in the probe batch
+    UINT pos;               // position of the inner page in the table file
+    UINT slot;              // tuple in the inner page
+}Probe_match;
+
+// state of index nested loop join, outer tuples probe the index on the
+// join attribute of the inner table batch by batch
+typedef struct Index_join_state{
+    Table_meta outer;
+    Table_meta inner;
+    UINT idx_outer;
+    UINT idx_inner;
+    INT flag;               // 1 if outer table is table 2 of the join
+    Index index;            // index on the join attribute of inner table
+    UINT64* pids_outer;
+    UINT64* pids_inner;
+    UINT64 pos_outer;       // next outer page to read
+    INT* probes;            // outer tuples of current batch
+    UINT nprobes;
+    Probe_match* matches;   // inner tuples found for the batch, in file order
+    UINT64 nmatches;
+    UINT64 match_capacity;
+    UINT64 m;               // next entry of matches
+    INT page_index;         // buffer slot of current inner page, UNUSED if none
+}Index_join_state;
+
+// state of in-memory hash join
+typedef struct Hash_state{
+    Table_meta build;
+    Table_meta probe;
+    UINT idx_build;
+    UINT idx_probe;
+    INT flag;               // 1 if build table is table 2 of the join
+    Hash_table hash_table;
+    UINT64* pids_probe;
+    UINT64 pos;             // next probe page to read
+    UINT64 ahead;           // next probe page to read ahead
+    INT page_index;         // buffer slot of current probe page, UNUSED if none
+    UINT np;                // current tuple of probe page
+    bool looked_up;         // whether r is the chain of current tuple
+    INT64 r;                // next matching row of build table
+    bool parallel;          // whether result was filled by a parallel join when opened
+    Tuple_buf result;       // tuples joined by the parallel join
+    UINT64 next;            // next tuple of result to return
+}Hash_state;
+
+// size of the hash table of one partition of a parallel hash join, about
+// what stays in L2 cache while it is built and probed
+#define HASH_PARTITION_BYTES (256 * 1024)
+
+// most partitions of a parallel hash join
+#define MAX_HASH_PARTITIONS 1024
+
+// shared state of a parallel hash join, the build table is radix
+// partitioned so that every thread builds the hash tables of the
+// partitions it claims without locks, then all threads probe them with
+// chunks of the probe table, each chunk joined into its own buffer
+typedef struct Parallel_hash{
+    const Hash_state* join;
+    UINT nparts;
+    const UINT64* pids_build;   // page ids of the build table
+    UINT64 nchunks_build;
+    Tuple_buf* build_chunks;    // tuples of each chunk of build pages, ordered by partition
+    UINT64* offsets;        // first tuple of partition p in build chunk c, at c * (nparts + 1) + p
+    Hash_table* tables;     // hash table of each partition
+    UINT64 nchunks_probe;
+    Tuple_buf* results;     // joined tuples of each chunk of probe pages
+    UINT64 next;            // next chunk or partition nobody claimed yet, taken atomically
+}Parallel_hash;
+
+// state of grace hash join
+typedef struct Grace_state{
+    Table_meta build;
+    Table_meta probe;
+    UINT idx_build;
+    UINT idx_probe;
+    INT flag;               // 1 if build table is table 2 of the join
+    UINT nparts;
+    Partition* parts_build;
+    Partition* parts_probe;
+    UINT64 chunk_capacity;  // tuples of build table held in hash table at a time
+    Hash_table hash_table;
+    UINT page_index;        // buffer slot partitions are read into
+    INT8* page;             // current page read from a partition
+    UINT p;                 // current partition
+    UINT64 pos_build;       // next page of build partition to load
+    bool chunk_loaded;      // whether hash table holds the current chunk
+    UINT64 pos_probe;       // current page of probe partition
+    bool page_loaded;       // whether page holds the current probe page
+    UINT ntuples;           // tuples in current probe page
+    UINT np;                // current tuple of probe page
+    bool looked_up;         // whether r is the chain of current tuple
+    INT64 r;                // next matching row of build table
+}Grace_state;
+
+// state of sort-merge join
+typedef struct Merge_state{
+    Table_meta table_1;
+    Table_meta table_2;
+    UINT idx1;
+    UINT idx2;
+    bool sorted_1;          // table 1 is stored in order of its join key
+    bool sorted_2;
+    Partition* run_1;       // sorted run of table 1, NULL if it is scanned in place
+    Partition* run_2;
+    Run_cursor c1;
+    Run_cursor c2;
+    Tuple_buf group;        // tuples of table 1 with current key
+    INT key;                // current key
+    bool in_group;          // whether tuples of table 2 with current key are being joined
+    UINT64 g;               // next tuple of group to join
+}Merge_state;
+
 void init();
 void release();
 
@@ -48,5 +402,32 @@ void release();
 // table_name: table name
 _Table* sel(const UINT idx, const INT cond_val, const char* table_name);
 
+// selection with any predicate of filter.h, e.g. a range of values
+// pred: the predicate, pred -> idx is the attribute for comparison
+// table_name: table name
+_Table* sel_pred(const Predicate* pred, const char* table_name);
+
+// selection with a conjunction or disjunction of predicates, possibly on
+// different attributes, all of them are evaluated in one scan
+_Table* sel_cond(const Condition* cond, const char* table_name);
+
+// build a B+-tree index over attribute idx of a table, selections on the
+// attribute use it from now on when it is cheaper than a scan
+void create_index(const UINT idx, const char* table_name);
+
 _Table* join(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name);
+
+// the same operators, returning tuples batch by batch instead of a whole _Table
+Operator* sel_op(const UINT idx, const INT cond_val, const char* table_name);
+Operator* sel_pred_op(const Predicate* pred, const char* table_name);
+Operator* sel_cond_op(const Condition* cond, const char* table_name);
+Operator* join_op(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name);
+
+void op_open(Operator* op);
+// clear batch and fill it with the next tuples, return 0 when all tuples are returned
+UINT op_next(Operator* op, Tuple_buf* batch);
+// close the operator and free it
+void op_close(Operator* op);
+// open, read all tuples into a _Table and close the operator
+_Table* op_materialize(Operator* op);
 #endif
\ No newline at end of file
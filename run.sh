@@ -17,3 +17,49 @@ test_folder='test'
 
 # mixed test 
  ./main 40 3 3 CLS ./data ./$test_folder/test5/data_5.txt ./$test_folder/test5/query_5.txt ./$test_folder/test5/log_5.txt 
+
+# range and inequality selection test
+ ./main 40 3 3 CLS ./data ./$test_folder/test6/data_6.txt ./$test_folder/test6/query_6.txt ./$test_folder/test6/log_6.txt 
+
+# index test
+ ./main 64 4 3 CLS ./data ./$test_folder/test7/data_7.txt ./$test_folder/test7/query_7.txt ./$test_folder/test7/log_7.txt 
+
+# reopen the database of the index test from its catalog
+ ./main 64 4 3 CLS ./data - ./$test_folder/test8/query_8.txt ./$test_folder/test8/log_8.txt 
+
+# mixed test with pages of sequential scans read ahead in the background
+ ./main 40 3 3 CLS ./data ./$test_folder/test5/data_5.txt ./$test_folder/test9/query_9.txt ./$test_folder/test9/log_9.txt prefetch=4
+
+# selection test with the tables loaded from a binary input file
+ ./main 50 3 3 CLS ./data ./$test_folder/test10/data_10.dbb ./$test_folder/test10/query_10.txt ./$test_folder/test10/log_10.txt
+
+# selection test with the tables loaded from a csv input file
+ ./main 50 3 3 CLS ./data ./$test_folder/test11/data_11.csv ./$test_folder/test11/query_11.txt ./$test_folder/test11/log_11.txt
+
+# selection test with table files mapped into memory instead of read, the
+# page size is a multiple of the size of an attribute so pages can be used in place
+ ./main 48 3 3 CLS ./data ./$test_folder/test2/data_2.txt ./$test_folder/test12/query_12.txt ./$test_folder/test12/log_12.txt smgr=mmap
+
+# selection tests under the other buffer replacement policies, the tuples
+# are those of clock sweep, the pages read depend on the policy
+ ./main 50 3 3 2Q ./data ./$test_folder/test2/data_2.txt ./$test_folder/test13/query_13.txt ./$test_folder/test13/log_13.txt
+ ./main 50 3 3 ARC ./data ./$test_folder/test2/data_2.txt ./$test_folder/test14/query_14.txt ./$test_folder/test14/log_14.txt
+ ./main 40 3 3 2Q ./data ./$test_folder/test6/data_6.txt ./$test_folder/test15/query_15.txt ./$test_folder/test15/log_15.txt
+ ./main 40 3 3 ARC ./data ./$test_folder/test6/data_6.txt ./$test_folder/test16/query_16.txt ./$test_folder/test16/log_16.txt
+ ./main 40 3 3 LRU ./data ./$test_folder/test6/data_6.txt ./$test_folder/test17/query_17.txt ./$test_folder/test17/log_17.txt
+ ./main 40 3 3 LRUK ./data ./$test_folder/test6/data_6.txt ./$test_folder/test18/query_18.txt ./$test_folder/test18/log_18.txt
+
+# empty table test, scans, joins and an index over a table without pages
+ ./main 64 3 3 CLS ./data ./$test_folder/test19/data_19.txt ./$test_folder/test19/query_19.txt ./$test_folder/test19/log_19.txt
+
+# parallel scan and parallel hash join test, the queries of test20 are run
+# serially and with 4 threads, the tuples must be the same, the number of
+# pages read is left out as it depends on how the threads share buffer pool
+ ./main 64 128 3 CLS ./data ./$test_folder/test20/data_20.txt ./$test_folder/test20/query_20.txt ./$test_folder/test20/log_20.txt
+ ./main 64 128 3 CLS ./data ./$test_folder/test20/data_20.txt ./$test_folder/test21/query_21.txt ./$test_folder/test21/log_21.txt parallel=4
+tuples(){
+    awk '/^######/{print; getline; print $1, $2; next}{print}' "$1"
+}
+if ! diff <(tuples ./$test_folder/test20/log_20.txt) <(tuples ./$test_folder/test21/log_21.txt); then
+    echo "test21: tuples of the parallel run differ from test20"
+fi
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "smgr.h"
+
+// backend and page size chosen by smgr_init
+static UINT backend = SMGR_PREAD;
+static UINT page_size = 0;
+
+static const char* names[NSMGR] = {"pread", "mmap"};
+
+// mappings of the files opened so far
+static Smgr_map* maps = NULL;
+static UINT nmaps = 0;
+
+void smgr_init(UINT b, UINT size){
+    backend = b < NSMGR ? b : SMGR_PREAD;
+    page_size = size;
+
+    // pages of a mapped file are used in place, their tuples are only
+    // aligned if the page size is a multiple of the size of an attribute
+    if (page_size % sizeof(INT) != 0){
+        backend = SMGR_PREAD;
+    }
+}
+
+void smgr_shutdown(){
+    for (UINT i = 0; i < nmaps; i++){
+        munmap(maps[i].map, maps[i].size);
+    }
+    free(maps);
+    maps = NULL;
+    nmaps = 0;
+}
+
+// the mapping of a file, the file is mapped when it is opened for the
+// first time, NULL if it cannot be mapped
+static INT8* get_map(INT fd, const struct stat* st){
+    for (UINT i = 0; i < nmaps; i++){
+        if (maps[i].dev == (UINT64)st -> st_dev && maps[i].ino == (UINT64)st -> st_ino
+            && maps[i].size == (UINT64)st -> st_size){
+            return maps[i].map;
+        }
+    }
+
+    void* map = mmap(NULL, st -> st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED){
+        return NULL;
+    }
+    maps = realloc(maps, sizeof(Smgr_map) * (nmaps + 1));
+    maps[nmaps].dev = st -> st_dev;
+    maps[nmaps].ino = st -> st_ino;
+    maps[nmaps].size = st -> st_size;
+    maps[nmaps].map = map;
+    nmaps++;
+    return map;
+}
+
+const char* smgr_name(UINT b){
+    return b < NSMGR ? names[b] : "unknown";
+}
+
+UINT smgr_parse(const char* name){
+    for (UINT b = 0; b < NSMGR; b++){
+        if (strcasecmp(name, names[b]) == 0){
+            return b;
+        }
+    }
+    return NSMGR;
+}
+
+bool smgr_open(Smgr_file* f, const char* path){
+    f -> fd = open(path, O_RDONLY);
+    f -> size = 0;
+    f -> map = NULL;
+    if (f -> fd == -1){
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(f -> fd, &st) == 0){
+        f -> size = st.st_size;
+
+        // an empty file cannot be mapped, it has no page to read anyway,
+        // a file that cannot be mapped is read by pread instead
+        if (backend == SMGR_MMAP && f -> size > 0){
+            f -> map = get_map(f -> fd, &st);
+        }
+    }
+    return true;
+}
+
+void smgr_close(Smgr_file* f){
+    // the mapping is kept, pages of buffer pool may still point into it
+    f -> map = NULL;
+    if (f -> fd != -1){
+        close(f -> fd);
+        f -> fd = -1;
+    }
+}
+
+UINT64 smgr_read(const Smgr_file* f, UINT64 pos, UINT64 n, INT8* buf){
+    UINT64 offset = pos * page_size;
+    if (offset >= f -> size){
+        return 0;
+    }
+    size_t len = n * page_size;
+    if (len > f -> size - offset){
+        len = f -> size - offset;
+    }
+
+    if (f -> map != NULL){
+        memcpy(buf, f -> map + offset, len);
+        return len / page_size;
+    }
+
+    // pread may return fewer bytes than asked, keep reading the rest
+    size_t done = 0;
+    while (done < len){
+        ssize_t nread = pread(f -> fd, buf + done, len - done, offset + done);
+        if (nread < 0 && errno == EINTR){
+            continue;
+        }
+        if (nread <= 0){
+            break;
+        }
+        done += nread;
+    }
+    return done / page_size;
+}
+
+INT8* smgr_map_page(const Smgr_file* f, UINT64 pos){
+    if (f -> map == NULL || (pos + 1) * page_size > f -> size){
+        return NULL;
+    }
+    return f -> map + pos * page_size;
+}
@@ -0,0 +1,50 @@
+#ifndef SMGR_H
+#define SMGR_H
+#include <stdbool.h>
+#include "db.h"
+
+// storage manager backends, how pages of table and index files are read
+#define SMGR_PREAD 0        // one positioned read per request into buffer pool
+#define SMGR_MMAP 1         // the file is mapped and pages are used in place
+#define NSMGR 2
+
+// an open table or index file, reads never move a shared cursor so
+// several threads can read the same file at once
+typedef struct Smgr_file{
+    INT fd;                 // -1 if the file is not open
+    UINT64 size;            // size of the file in bytes when it was opened
+    INT8* map;              // read only mapping of the whole file, NULL unless SMGR_MMAP
+}Smgr_file;
+
+// mapping of a file, shared by every open of the same file and kept
+// until smgr_shutdown, so pages used in place stay valid after the file
+// is closed to open another one
+typedef struct Smgr_map{
+    UINT64 dev;
+    UINT64 ino;
+    UINT64 size;
+    INT8* map;
+}Smgr_map;
+
+// choose the backend used by files opened from now on
+void smgr_init(UINT backend, UINT page_size);
+// unmap every file mapped since smgr_init
+void smgr_shutdown();
+
+// name of a backend, and the backend of a name, NSMGR if there is none
+const char* smgr_name(UINT backend);
+UINT smgr_parse(const char* name);
+
+// return false if the file cannot be opened
+bool smgr_open(Smgr_file* f, const char* path);
+void smgr_close(Smgr_file* f);
+
+// copy n pages starting at page pos into buf
+// return number of whole pages read, fewer than n at the end of file
+UINT64 smgr_read(const Smgr_file* f, UINT64 pos, UINT64 n, INT8* buf);
+
+// address of page pos in the mapping of the file, NULL if the file is
+// not mapped or the page is beyond its end
+INT8* smgr_map_page(const Smgr_file* f, UINT64 pos);
+
+#endif